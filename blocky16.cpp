@@ -26,6 +26,7 @@
 #include <string.h>
 #include <SDL_endian.h>
 #include "blocky16.h"
+#include "blockytables.h"
 #include "util.h"
 
 #define COPY_4X1_LINE(dst, src)			\
@@ -70,277 +71,17 @@
 
 #endif
 
-static const int8 blocky16_table_small1[] = {
-	0, 1, 2, 3, 3, 3, 3, 2, 1, 0, 0, 0, 1, 2, 2, 1,
-};
-
-static const int8 blocky16_table_small2[] = {
-	0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 2, 1, 1, 1, 2, 2,
-};
-
-static const int8 blocky16_table_big1[] = {
-	0, 2, 5, 7, 7, 7, 7, 7, 7, 5, 2, 0, 0, 0, 0, 0,
-};
-
-static const int8 blocky16_table_big2[] = {
-	0, 0, 0, 0, 1, 3, 4, 6, 7, 7, 7, 7, 6, 4, 3, 1,
-};
-
-static const int8 blocky16_table[] = {
-	  0,   0,  -1, -43,   6, -43,  -9, -42,  13, -41,
-	-16, -40,  19, -39, -23, -36,  26, -34,  -2, -33,
-	  4, -33, -29, -32,  -9, -32,  11, -31, -16, -29,
-	 32, -29,  18, -28, -34, -26, -22, -25,  -1, -25,
-	  3, -25,  -7, -24,   8, -24,  24, -23,  36, -23,
-	-12, -22,  13, -21, -38, -20,   0, -20, -27, -19,
-	 -4, -19,   4, -19, -17, -18,  -8, -17,   8, -17,
-	 18, -17,  28, -17,  39, -17, -12, -15,  12, -15,
-	-21, -14,  -1, -14,   1, -14, -41, -13,  -5, -13,
-	  5, -13,  21, -13, -31, -12, -15, -11,  -8, -11,
-	  8, -11,  15, -11,  -2, -10,   1, -10,  31, -10,
-	-23,  -9, -11,  -9,  -5,  -9,   4,  -9,  11,  -9,
-	 42,  -9,   6,  -8,  24,  -8, -18,  -7,  -7,  -7,
-	 -3,  -7,  -1,  -7,   2,  -7,  18,  -7, -43,  -6,
-	-13,  -6,  -4,  -6,   4,  -6,   8,  -6, -33,  -5,
-	 -9,  -5,  -2,  -5,   0,  -5,   2,  -5,   5,  -5,
-	 13,  -5, -25,  -4,  -6,  -4,  -3,  -4,   3,  -4,
-	  9,  -4, -19,  -3,  -7,  -3,  -4,  -3,  -2,  -3,
-	 -1,  -3,   0,  -3,   1,  -3,   2,  -3,   4,  -3,
-	  6,  -3,  33,  -3, -14,  -2, -10,  -2,  -5,  -2,
-	 -3,  -2,  -2,  -2,  -1,  -2,   0,  -2,   1,  -2,
-	  2,  -2,   3,  -2,   5,  -2,   7,  -2,  14,  -2,
-	 19,  -2,  25,  -2,  43,  -2,  -7,  -1,  -3,  -1,
-	 -2,  -1,  -1,  -1,   0,  -1,   1,  -1,   2,  -1,
-	  3,  -1,  10,  -1,  -5,   0,  -3,   0,  -2,   0,
-	 -1,   0,   1,   0,   2,   0,   3,   0,   5,   0,
-	  7,   0, -10,   1,  -7,   1,  -3,   1,  -2,   1,
-	 -1,   1,   0,   1,   1,   1,   2,   1,   3,   1,
-	-43,   2, -25,   2, -19,   2, -14,   2,  -5,   2,
-	 -3,   2,  -2,   2,  -1,   2,   0,   2,   1,   2,
-	  2,   2,   3,   2,   5,   2,   7,   2,  10,   2,
-	 14,   2, -33,   3,  -6,   3,  -4,   3,  -2,   3,
-	 -1,   3,   0,   3,   1,   3,   2,   3,   4,   3,
-	 19,   3,  -9,   4,  -3,   4,   3,   4,   7,   4,
-	 25,   4, -13,   5,  -5,   5,  -2,   5,   0,   5,
-	  2,   5,   5,   5,   9,   5,  33,   5,  -8,   6,
-	 -4,   6,   4,   6,  13,   6,  43,   6, -18,   7,
-	 -2,   7,   0,   7,   2,   7,   7,   7,  18,   7,
-	-24,   8,  -6,   8, -42,   9, -11,   9,  -4,   9,
-	  5,   9,  11,   9,  23,   9, -31,  10,  -1,  10,
-	  2,  10, -15,  11,  -8,  11,   8,  11,  15,  11,
-	 31,  12, -21,  13,  -5,  13,   5,  13,  41,  13,
-	 -1,  14,   1,  14,  21,  14, -12,  15,  12,  15,
-	-39,  17, -28,  17, -18,  17,  -8,  17,   8,  17,
-	 17,  18,  -4,  19,   0,  19,   4,  19,  27,  19,
-	 38,  20, -13,  21,  12,  22, -36,  23, -24,  23,
-	 -8,  24,   7,  24,  -3,  25,   1,  25,  22,  25,
-	 34,  26, -18,  28, -32,  29,  16,  29, -11,  31,
-	  9,  32,  29,  32,  -4,  33,   2,  33, -26,  34,
-	 23,  36, -19,  39,  16,  40, -13,  41,   9,  42,
-	 -6,  43,   1,  43,   0,   0,   0,   0,   0,   0,
-	  0,   0,   0
-};
-
-void Blocky16::makeTablesInterpolation(int param) {
-	int32 variable1, variable2;
-	int32 b1, b2;
-	int32 value_table47_1_2, value_table47_1_1, value_table47_2_2, value_table47_2_1;
-	int32 tableSmallBig[64], tmp, s;
-	const int8 *table47_1 = 0, *table47_2 = 0;
-	int32 *ptr_small_big;
-	byte *ptr;
-	int i, x, y;
-
-	if (param == 8) {
-		table47_1 = blocky16_table_big1;
-		table47_2 = blocky16_table_big2;
-		ptr = _tableBig + 384;
-		for (i = 0; i < 256; i++) {
-			*ptr = 0;
-			ptr += 388;
-		}
-		ptr = _tableBig + 385;
-		for (i = 0; i < 256; i++) {
-			*ptr = 0;
-			ptr += 388;
-		}
-	} else if (param == 4) {
-		table47_1 = blocky16_table_small1;
-		table47_2 = blocky16_table_small2;
-		ptr = _tableSmall + 96;
-		for (i = 0; i < 256; i++) {
-			*ptr = 0;
-			ptr += 128;
-		}
-		ptr = _tableSmall + 97;
-		for (i = 0; i < 256; i++) {
-			*ptr = 0;
-			ptr += 128;
-		}
-	}
-
-	s = 0;
-	for (x = 0; x < 16; x++) {
-		value_table47_1_1 = table47_1[x];
-		value_table47_2_1 = table47_2[x];
-		for (y = 0; y < 16; y++) {
-			value_table47_1_2 = table47_1[y];
-			value_table47_2_2 = table47_2[y];
-
-			if (value_table47_2_1 == 0) {
-				b1 = 0;
-			} else if (value_table47_2_1 == param - 1) {
-				b1 = 1;
-			} else if (value_table47_1_1 == 0) {
-				b1 = 2;
-			} else if (value_table47_1_1 == param - 1) {
-				b1 = 3;
-			} else {
-				b1 = 4;
-			}
-
-			if (value_table47_2_2 == 0) {
-				b2 = 0;
-			} else if (value_table47_2_2 == param - 1) {
-				b2 = 1;
-			} else if (value_table47_1_2 == 0) {
-				b2 = 2;
-			} else if (value_table47_1_2 == param - 1) {
-				b2 = 3;
-			} else {
-				b2 = 4;
-			}
-
-			memset(tableSmallBig, 0, param * param * 4);
-
-			variable2 = ABS(value_table47_2_2 - value_table47_2_1);
-			tmp = ABS(value_table47_1_2 - value_table47_1_1);
-			if (variable2 <= tmp) {
-				variable2 = tmp;
-			}
-
-			for (variable1 = 0; variable1 <= variable2; variable1++) {
-				int32 variable3, variable4;
-
-				if (variable2 > 0) {
-					// Linearly interpolate between value_table47_1_1 and value_table47_1_2
-					// respectively value_table47_2_1 and value_table47_2_2.
-					variable4 = (value_table47_1_1 * variable1 + value_table47_1_2 * (variable2 - variable1) + variable2 / 2) / variable2;
-					variable3 = (value_table47_2_1 * variable1 + value_table47_2_2 * (variable2 - variable1) + variable2 / 2) / variable2;
-				} else {
-					variable4 = value_table47_1_1;
-					variable3 = value_table47_2_1;
-				}
-				ptr_small_big = &tableSmallBig[param * variable3 + variable4];
-				*ptr_small_big = 1;
-
-				if ((b1 == 2 && b2 == 3) || (b2 == 2 && b1 == 3) ||
-				    (b1 == 0 && b2 != 1) || (b2 == 0 && b1 != 1)) {
-					if (variable3 >= 0) {
-						i = variable3 + 1;
-						while (i--) {
-							*ptr_small_big = 1;
-							ptr_small_big -= param;
-						}
-					}
-				} else if ((b2 != 0 && b1 == 1) || (b1 != 0 && b2 == 1)) {
-					if (param > variable3) {
-						i = param - variable3;
-						while (i--) {
-							*ptr_small_big = 1;
-							ptr_small_big += param;
-						}
-					}
-				} else if ((b1 == 2 && b2 != 3) || (b2 == 2 && b1 != 3)) {
-					if (variable4 >= 0) {
-						i = variable4 + 1;
-						while (i--) {
-							*(ptr_small_big--) = 1;
-						}
-					}
-				} else if ((b1 == 0 && b2 == 1) || (b2 == 0 && b1 == 1) ||
-				           (b1 == 3 && b2 != 2) || (b2 == 3 && b1 != 2)) {
-					if (param > variable4) {
-						i = param - variable4;
-						while (i--) {
-							*(ptr_small_big++) = 1;
-						}
-					}
-				}
-			}
-
-			if (param == 8) {
-				for (i = 64 - 1; i >= 0; i--) {
-					if (tableSmallBig[i] != 0) {
-						_tableBig[256 + s + _tableBig[384 + s]] = (byte)i;
-						_tableBig[384 + s]++;
-					} else {
-						_tableBig[320 + s + _tableBig[385 + s]] = (byte)i;
-						_tableBig[385 + s]++;
-					}
-				}
-				s += 388;
-			}
-			if (param == 4) {
-				for (i = 16 - 1; i >= 0; i--) {
-					if (tableSmallBig[i] != 0) {
-						_tableSmall[64 + s + _tableSmall[96 + s]] = (byte)i;
-						_tableSmall[96 + s]++;
-					} else {
-						_tableSmall[80 + s + _tableSmall[97 + s]] = (byte)i;
-						_tableSmall[97 + s]++;
-					}
-				}
-				s += 128;
-			}
-		}
-	}
-}
-
-void Blocky16::makeTables47(int width) {
-	if (_lastTableWidth == width)
-		return;
-
-	_lastTableWidth = width;
-
-	int32 a, c, d;
-	int16 tmp;
-
-	for (int l = 0; l < 512; l += 2) {
-		_table[l / 2] = (int16)(blocky16_table[l + 1] * width + blocky16_table[l]);
-	}
-
-	a = 0;
-	c = 0;
-	do {
-		for (d = 0; d < _tableSmall[96 + c]; d++) {
-			tmp = _tableSmall[64 + c + d];
-			tmp = (int16)((byte)(tmp >> 2) * width + (tmp & 3));
-			_tableSmall[c + d * 2] = (byte)tmp;
-			_tableSmall[c + d * 2 + 1] = tmp >> 8;
-		}
-		for (d = 0; d < _tableSmall[97 + c]; d++) {
-			tmp = _tableSmall[80 + c + d];
-			tmp = (int16)((byte)(tmp >> 2) * width + (tmp & 3));
-			_tableSmall[32 + c + d * 2] = (byte)tmp;
-			_tableSmall[32 + c + d * 2 + 1] = tmp >> 8;
-		}
-		for (d = 0; d < _tableBig[384 + a]; d++) {
-			tmp = _tableBig[256 + a + d];
-			tmp = (int16)((byte)(tmp >> 3) * width + (tmp & 7));
-			_tableBig[a + d * 2] = (byte)tmp;
-			_tableBig[a + d * 2 + 1] = tmp >> 8;
-		}
-		for (d = 0; d < _tableBig[385 + a]; d++) {
-			tmp = _tableBig[320 + a + d];
-			tmp = (int16)((byte)(tmp >> 3) * width + (tmp & 7));
-			_tableBig[128 + a + d * 2] = (byte)tmp;
-			_tableBig[128 + a + d * 2 + 1] = tmp >> 8;
-		}
+// Convert little endian pixels in place to the native byte order
+static inline void convertLEPixels(byte *buf, int size) {
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	uint16 *pixel = (uint16 *)buf;
 
-		a += 388;
-		c += 128;
-	} while (c < 32768);
+	for (int i = 0; i < size / 2; i++)
+		pixel[i] = SWAP_BYTES_16(pixel[i]);
+#else
+	(void)buf;
+	(void)size;
+#endif
 }
 
 void Blocky16::level3(byte *d_dst) {
@@ -355,7 +96,7 @@ void Blocky16::level3(byte *d_dst) {
 			tmp2 = tmp * 2;
 			_d_src += 2;
 		} else {
-			tmp2 = _table[code] * 2;
+			tmp2 = _offsets->motion[code] * 2;
 		}
 		tmp2 += _offset1;
 		for (i = 0; i < 2; i++) {
@@ -422,7 +163,7 @@ void Blocky16::level2(byte *d_dst) {
 			tmp2 = tmp * 2;
 			_d_src += 2;
 		} else {
-			tmp2 = _table[code] * 2;
+			tmp2 = _offsets->motion[code] * 2;
 		}
 		tmp2 += _offset1;
 		for (i = 0; i < 4; i++) {
@@ -456,19 +197,17 @@ void Blocky16::level2(byte *d_dst) {
 			val |= READ_LE_UINT16(_param6_7Ptr + (byte)tmp2 * 2);
 			_d_src += 2;
 		}
-		byte *tmp_ptr = _tableSmall + (tmp * 128);
-		byte l = tmp_ptr[96];
-		int16 *tmp_ptr2 = (int16 *)tmp_ptr;
+		const uint16 *offsets = _offsets->small[tmp];
+		byte l = _patternsSmall[tmp].count[0];
 		while (l--) {
-			WRITE_2X1_LINE(d_dst + READ_LE_UINT16(tmp_ptr2) * 2, val);
-			tmp_ptr2++;
+			WRITE_2X1_LINE(d_dst + *offsets * 2, val);
+			offsets++;
 		}
-		l = tmp_ptr[97];
+		l = _patternsSmall[tmp].count[1];
 		val >>= 16;
-		tmp_ptr2 = (int16 *)(tmp_ptr + 32);
 		while (l--) {
-			WRITE_2X1_LINE(d_dst + READ_LE_UINT16(tmp_ptr2) * 2, val);
-			tmp_ptr2++;
+			WRITE_2X1_LINE(d_dst + *offsets * 2, val);
+			offsets++;
 		}
 	} else if (code >= 0xF9) {
 		if (code == 0xFD) {
@@ -491,7 +230,7 @@ void Blocky16::level2(byte *d_dst) {
 	}
 }
 
-void Blocky16::level1(byte *d_dst) {
+bool Blocky16::level1(byte *d_dst) {
 	int32 tmp2;
 	uint32 t = 0, val;
 	byte code = *_d_src++;
@@ -503,8 +242,9 @@ void Blocky16::level1(byte *d_dst) {
 			tmp2 = tmp * 2;
 			_d_src += 2;
 		} else {
-			tmp2 = _table[code] * 2;
+			tmp2 = _offsets->motion[code] * 2;
 		}
+		bool moved = tmp2 != 0;
 		tmp2 += _offset1;
 		for (i = 0; i < 8; i++) {
 			COPY_4X1_LINE(d_dst +  0, d_dst + tmp2 +  0);
@@ -513,6 +253,8 @@ void Blocky16::level1(byte *d_dst) {
 			COPY_4X1_LINE(d_dst + 12, d_dst + tmp2 + 12);
 			d_dst += _d_pitch;
 		}
+
+		return !_offset1Clean || moved;
 	} else if (code == 0xFF) {
 		level2(d_dst);
 		d_dst += 8;
@@ -530,6 +272,7 @@ void Blocky16::level1(byte *d_dst) {
 			COPY_4X1_LINE(d_dst + 12, d_dst + tmp2 + 12);
 			d_dst += _d_pitch;
 		}
+		return !_offset2Clean;
 	} else if ((code == 0xF7) || (code == 0xF8)) {
 		byte tmp = *_d_src++;
 		if (code == 0xF8) {
@@ -541,19 +284,17 @@ void Blocky16::level1(byte *d_dst) {
 			val |= READ_LE_UINT16(_param6_7Ptr + (byte)tmp2 * 2);
 			_d_src += 2;
 		}
-		byte *tmp_ptr = _tableBig + (tmp * 388);
-		byte l = tmp_ptr[384];
-		int16 *tmp_ptr2 = (int16 *)tmp_ptr;
+		const uint16 *offsets = _offsets->big[tmp];
+		byte l = _patternsBig[tmp].count[0];
 		while (l--) {
-			WRITE_2X1_LINE(d_dst + READ_LE_UINT16(tmp_ptr2) * 2, val);
-			tmp_ptr2++;
+			WRITE_2X1_LINE(d_dst + *offsets * 2, val);
+			offsets++;
 		}
-		l = tmp_ptr[385];
+		l = _patternsBig[tmp].count[1];
 		val >>= 16;
-		tmp_ptr2 = (int16 *)(tmp_ptr + 128);
 		while (l--) {
-			WRITE_2X1_LINE(d_dst + READ_LE_UINT16(tmp_ptr2) * 2, val);
-			tmp_ptr2++;
+			WRITE_2X1_LINE(d_dst + *offsets * 2, val);
+			offsets++;
 		}
 	} else if (code >= 0xF9) {
 		if (code == 0xFD) {
@@ -576,6 +317,8 @@ void Blocky16::level1(byte *d_dst) {
 			d_dst += _d_pitch;
 		}
 	}
+
+	return true;
 }
 
 void Blocky16::decode2(byte *dst, const byte *src, int width, int height, const byte *param_ptr, const byte *param6_7_ptr) {
@@ -587,10 +330,12 @@ void Blocky16::decode2(byte *dst, const byte *src, int width, int height, const
 	int next_line = width * 2 * 7;
 	_d_pitch = width * 2;
 
+	byte *dirty = _dirtyBlocks;
+
 	do {
 		int tmp_bw = bw;
 		do {
-			level1(dst);
+			*dirty++ = level1(dst);
 			dst += 16;
 		} while (--tmp_bw);
 		dst += next_line;
@@ -598,30 +343,31 @@ void Blocky16::decode2(byte *dst, const byte *src, int width, int height, const
 }
 
 Blocky16::Blocky16(uint width, uint height) {
-	_tableBig = new byte[99328];
-	_tableSmall = new byte[32768];
-	memset(_tableBig, 0, 99328);
-	memset(_tableSmall, 0, 32768);
+	_patternsSmall = getBlockyPatterns(4);
+	_patternsBig = getBlockyPatterns(8);
+	_offsets = getBlockyOffsets(width);
 	_width = width;
 	_height = height;
-	makeTablesInterpolation(4);
-	makeTablesInterpolation(8);
 
 	_frameSize = _width * _height * 2;
-	// workaround for read over buffer by increasing buffer
-	// 200 bytes is enough for smush anims:
-	// lol, byeruba, crushed, eldepot, heltrain, hostage
-	// but for tb_kitty.snm 5700 bytes is needed
-	_deltaSize = _frameSize * 3 + 5700;
-	_deltaBuf = new byte[_deltaSize];
-	memset(_deltaBuf, 0, _deltaSize);
-	_deltaBufs[0] = _deltaBuf;
-	_deltaBufs[1] = _deltaBuf + _frameSize;
-	_curBuf = _deltaBuf + _frameSize * 2;
+
+	// Blocks can be copied from outside of the frame (tb_kitty.snm does
+	// it), so every buffer gets a guard band that covers the furthest
+	// motion vector or absolute offset, plus the size of a block hanging
+	// off of the last row or column.
+	int32 reach = MAX<int32>(BLOCKY_MAX_MOTION * (_width + 1), BLOCKY_MAX_OFFSET);
+	int32 guardSize = (reach + 8 * (_width + 1)) * 2;
+	_deltaBuf = allocateGuardedBuffers(_bufs, 3, _frameSize, guardSize, _deltaSize);
+	_deltaBufs[0] = _bufs[0];
+	_deltaBufs[1] = _bufs[1];
+	_curBuf = _bufs[2];
+
+	_dirtyBlocks = new byte[((_width + 7) / 8) * ((_height + 7) / 8)];
+	_allDirty = true;
+	_lastFrame = 0;
 }
 
 Blocky16::~Blocky16() {
-	_lastTableWidth = -1;
 	if (_deltaBuf) {
 		delete[] _deltaBuf;
 		_deltaSize = 0;
@@ -629,84 +375,127 @@ Blocky16::~Blocky16() {
 		_deltaBufs[0] = 0;
 		_deltaBufs[1] = 0;
 	}
-	if (_tableBig) {
-		delete[] _tableBig;
-		_tableBig = 0;
-	}
-	if (_tableSmall) {
-		delete[] _tableSmall;
-		_tableSmall = 0;
-	}
+
+	delete[] _dirtyBlocks;
 }
 
-byte Blocky16::bompDecode() {
-	byte code, result;
-	const byte *src;
-
-	if (_bompLeft == 2) {
-		src = _bompSrc;
-		_bompNum = (*src >> 1) + 1;
-		code = *(src++) & 1;
-		_bompSrc = src;
-		if (code != 0) {
-			_bompLeft = 1;
-			_bompColor = *src++;
-			_bompSrc = src;
+void Blocky16::bompDecodeMain(byte *dst, const byte *src, int size) {
+	// The runs can go straight into the buffer, since the pixels only need
+	// to be byte-swapped on big endian hosts. A run may go past the end of
+	// the frame, so it gets cut short there.
+	byte *end = dst + (size & ~1);
+
+	for (byte *ptr = dst; ptr < end;) {
+		int num = MIN<int>((*src >> 1) + 1, end - ptr);
+
+		if (*src++ & 1) {
+			memset(ptr, *src++, num);
 		} else {
-			_bompLeft = 0;
+			memcpy(ptr, src, num);
+			src += num;
 		}
-	} else {
-		src = _bompSrc;
+
+		ptr += num;
 	}
-	if (_bompLeft != 0) {
-		if (_bompLeft - 1 == 0) {
-			result = _bompColor;
+
+	convertLEPixels(dst, end - dst);
+}
+
+void Blocky16::bompDecodeIndexed(uint16 *dst, const byte *src, int count) {
+	while (count > 0) {
+		int num = MIN<int>((*src >> 1) + 1, count);
+
+		if (*src++ & 1) {
+			uint16 color = _palette[*src++];
+			for (int i = 0; i < num; i++)
+				dst[i] = color;
 		} else {
-			result = 255;
+			expandIndexed(dst, src, num);
+			src += num;
 		}
-	} else {
-		result = *(src++);
-		_bompSrc = src;
+
+		dst += num;
+		count -= num;
 	}
+}
+
+void Blocky16::loadPalette(const byte *src) {
+	for (int i = 0; i < 256; i++)
+		_palette[i] = READ_LE_UINT16(src + i * 2);
+}
 
-	_bompNum--;
-	if (_bompNum == 0) {
-		_bompLeft = 2;
+void Blocky16::expandIndexed(uint16 *dst, const byte *src, int count) {
+	const uint16 *palette = _palette;
+
+	// Do eight pixels at a time. The loads and stores are independent of
+	// each other, so this keeps the CPU busy until memory becomes the limit.
+	while (count >= 8) {
+		dst[0] = palette[src[0]];
+		dst[1] = palette[src[1]];
+		dst[2] = palette[src[2]];
+		dst[3] = palette[src[3]];
+		dst[4] = palette[src[4]];
+		dst[5] = palette[src[5]];
+		dst[6] = palette[src[6]];
+		dst[7] = palette[src[7]];
+		dst += 8;
+		src += 8;
+		count -= 8;
 	}
 
-	return result;
+	while (count--)
+		*dst++ = palette[*src++];
 }
 
-void Blocky16::bompInit(const byte *src) {
-	_bompLeft = 2;
-	_bompSrc = src;
+byte *Blocky16::findFreeBuffer(const byte *used1, const byte *used2) const {
+	for (int i = 0; i < 3; i++)
+		if (_bufs[i] != used1 && _bufs[i] != used2)
+			return _bufs[i];
+
+	return 0;
 }
 
-void Blocky16::bompDecodeMain(byte *dst, const byte *src, int size) {
-	size /= 2;
-	bompInit(src);
-	while (size--) {
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-		*(dst + 1) = bompDecode();
-		*(dst + 0) = bompDecode();
-#else
-		*(dst + 0) = bompDecode();
-		*(dst + 1) = bompDecode();
-#endif
-		dst += 2;
+void Blocky16::setRepeatedDirty() {
+	// Nothing changed if the frame being repeated is the last one
+	if (_curBuf == _lastFrame) {
+		memset(_dirtyBlocks, 0, ((_width + 7) / 8) * ((_height + 7) / 8));
+		_allDirty = false;
 	}
 }
 
-void Blocky16::decode(byte *dst, const byte *src) {
-	_offset1 = ((_deltaBufs[1] - _curBuf) / 2) * 2;
-	_offset2 = ((_deltaBufs[0] - _curBuf) / 2) * 2;
+void Blocky16::prepareCurBuf(bool keepContents) {
+	// Frame types 3 and 4 just point _curBuf at one of the delta buffers
+	// instead of copying it. Before writing a new frame, give _curBuf its
+	// own buffer back.
+	if (_curBuf != _deltaBufs[0] && _curBuf != _deltaBufs[1])
+		return;
+
+	byte *buf = findFreeBuffer(_deltaBufs[0], _deltaBufs[1]);
+
+	if (keepContents)
+		memcpy(buf, _curBuf, _frameSize);
 
+	_curBuf = buf;
+}
+
+const byte *Blocky16::decode(const byte *src) {
 	int32 seq_nb = READ_LE_UINT16(src + 16);
 
 	const byte *gfx_data = src + 560;
 
+	// Only block coded frames and repeated frames can tell what changed
+	_allDirty = true;
+
 	if (seq_nb == 0) {
-		makeTables47(_width);
+		// The previous frame is gone after this
+		_lastFrame = 0;
+
+		// The delta buffers get reset, so they can't share memory with each
+		// other or with _curBuf anymore
+		prepareCurBuf(true);
+		if (_deltaBufs[0] == _deltaBufs[1])
+			_deltaBufs[0] = findFreeBuffer(_curBuf, _deltaBufs[1]);
+
 		if (src[32] == src[33]) {
 			memset(_deltaBufs[0], src[32], _frameSize);
 			memset(_deltaBufs[1], src[32], _frameSize);
@@ -726,52 +515,61 @@ void Blocky16::decode(byte *dst, const byte *src) {
 
 	switch(src[18]) {
 	case 0:
-		for (int i = 0; i < _width * _height; i++)
-			((uint16 *)_curBuf)[i] = READ_LE_UINT16(gfx_data + i * 2);
+		prepareCurBuf(false);
+		memcpy(_curBuf, gfx_data, _frameSize);
+		convertLEPixels(_curBuf, _frameSize);
 		break;
 	case 1:
 		fprintf(stderr, "Blocky16: Unimplemented proc 1\n");
-		return;
+		return 0;
 	case 2:
 		if (seq_nb == _prevSeqNb + 1) {
+			prepareCurBuf(false);
+			_offset1 = ((_deltaBufs[1] - _curBuf) / 2) * 2;
+			_offset2 = ((_deltaBufs[0] - _curBuf) / 2) * 2;
+
+			// Copying a block from the same spot in the last frame leaves
+			// it unchanged
+			_offset1Clean = _deltaBufs[1] == _lastFrame;
+			_offset2Clean = _deltaBufs[0] == _lastFrame;
+
 			decode2(_curBuf, gfx_data, _width, _height, src + 24, src + 40);
+			_allDirty = false;
 		}
 
 		break;
 	case 3:
-		memcpy(_curBuf, _deltaBufs[1], _frameSize);
+		// Repeat the previous frame
+		_curBuf = _deltaBufs[1];
+		setRepeatedDirty();
 		break;
 	case 4:
-		memcpy(_curBuf, _deltaBufs[0], _frameSize);
+		// Repeat the frame before the previous one
+		_curBuf = _deltaBufs[0];
+		setRepeatedDirty();
 		break;
 	case 5:
-		bompDecodeMain(_curBuf, gfx_data, READ_LE_UINT32(src + 36));
+		prepareCurBuf(true);
+		bompDecodeMain(_curBuf, gfx_data, MIN<uint32>(READ_LE_UINT32(src + 36), _frameSize));
 		break;
-	case 6: {
-		int count = _frameSize / 2;
-		uint16 *ptr = (uint16 *)_curBuf;
-		while (count--) {
-			int offset = *gfx_data++ * 2;
-			*(uint16 *)ptr++ = READ_LE_UINT16(src + 40 + offset);
-		};
+	case 6:
+		prepareCurBuf(false);
+		loadPalette(src + 40);
+		expandIndexed((uint16 *)_curBuf, gfx_data, _frameSize / 2);
 		break;
-	}
 	case 7:
 		fprintf(stderr, "Blocky16: Unimplemented proc 7\n");
-		return;
-	case 8: {
-		bompInit(gfx_data);
-		int count = _frameSize / 2;
-		uint16 *ptr = (uint16 *)_curBuf;
-		while (count--) {
-			int offset = bompDecode() * 2;
-			*(uint16 *)ptr++ = READ_LE_UINT16(src + 40 + offset);
-		};
+		return 0;
+	case 8:
+		prepareCurBuf(false);
+		loadPalette(src + 40);
+		bompDecodeIndexed((uint16 *)_curBuf, gfx_data, _frameSize / 2);
 		break;
 	}
-	}
 
-	memcpy(dst, _curBuf, _frameSize);
+	// Hand out the frame before the buffers get rotated
+	const byte *frame = _curBuf;
+	_lastFrame = frame;
 
 	if (seq_nb == _prevSeqNb + 1) {
 		byte *tmp_ptr = 0;
@@ -788,4 +586,5 @@ void Blocky16::decode(byte *dst, const byte *src) {
 	}
 
 	_prevSeqNb = seq_nb;
+	return frame;
 }
@@ -27,43 +27,68 @@
 
 #include "types.h"
 
+struct BlockyOffsets;
+struct BlockyPattern;
+
 class Blocky16 {
 public:
 	Blocky16(uint width, uint height);
 	~Blocky16();
-	void decode(byte *dst, const byte *src);
+
+	/**
+	 * Decode a frame. The returned buffer belongs to the decoder and stays
+	 * valid until the next call. Returns 0 if the frame could not be
+	 * decoded.
+	 */
+	const byte *decode(const byte *src);
+
+	/**
+	 * Get the 8x8 blocks that changed in the last decoded frame, compared
+	 * to the frame decoded before it. There is one byte per block, row by
+	 * row, which is non-zero if the block changed.
+	 *
+	 * @return the block map, or 0 if the whole frame has to be treated as
+	 * changed
+	 */
+	const byte *getDirtyBlocks() const { return _allDirty ? 0 : _dirtyBlocks; }
 
 private:
 	int32 _deltaSize;
+	byte *_bufs[3];
 	byte *_deltaBufs[2];
 	byte *_deltaBuf;
 	byte *_curBuf;
 	int32 _prevSeqNb;
-	int _lastTableWidth;
 	const byte *_d_src, *_paramPtr, *_param6_7Ptr;
 	int _d_pitch;
 	int32 _offset1, _offset2;
-	byte *_tableBig;
-	byte *_tableSmall;
-	int16 _table[256];
+	const BlockyPattern *_patternsSmall, *_patternsBig;
+	const BlockyOffsets *_offsets;
 	int32 _frameSize;
 	int _width, _height;
 
-	void makeTablesInterpolation(int param);
-	void makeTables47(int width);
-	void level1(byte *d_dst);
+	bool level1(byte *d_dst);
 	void level2(byte *d_dst);
 	void level3(byte *d_dst);
 	void decode2(byte *dst, const byte *src, int width, int height, const byte *param_ptr, const byte *param6_7_ptr);
+	byte *findFreeBuffer(const byte *used1, const byte *used2) const;
+	void prepareCurBuf(bool keepContents);
+	void setRepeatedDirty();
+
+	// Dirty blocks
+	byte *_dirtyBlocks;
+	bool _allDirty;
+	const byte *_lastFrame;
+	bool _offset1Clean, _offset2Clean;
 
 	// BOMP
 	void bompDecodeMain(byte *dst, const byte *src, int size);
-	void bompInit(const byte *src);
-	byte bompDecode();
-	int _bompLeft;
-	int _bompNum;
-	int _bompColor;
-	const byte *_bompSrc;
+	void bompDecodeIndexed(uint16 *dst, const byte *src, int count);
+
+	// Palette (frame types 6 and 8)
+	void loadPalette(const byte *src);
+	void expandIndexed(uint16 *dst, const byte *src, int count);
+	uint16 _palette[256];
 };
 
 #endif
@@ -0,0 +1,307 @@
+/* smushplay - A simple LucasArts SMUSH video player
+ *
+ * smushplay is the legal property of its developers, whose names can be
+ * found in the AUTHORS file distributed with this source
+ * distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+// Based on the ScummVM and ResidualVM SMUSH code (GPLv2+ and LGPL v2.1,
+// respectively).
+
+#include <map>
+#include <string.h>
+#include "blockytables.h"
+#include "util.h"
+
+static const int8 blockyTableSmall1[] = {
+	0, 1, 2, 3, 3, 3, 3, 2, 1, 0, 0, 0, 1, 2, 2, 1,
+};
+
+static const int8 blockyTableSmall2[] = {
+	0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 2, 1, 1, 1, 2, 2,
+};
+
+static const int8 blockyTableBig1[] = {
+	0, 2, 5, 7, 7, 7, 7, 7, 7, 5, 2, 0, 0, 0, 0, 0,
+};
+
+static const int8 blockyTableBig2[] = {
+	0, 0, 0, 0, 1, 3, 4, 6, 7, 7, 7, 7, 6, 4, 3, 1,
+};
+
+static const int8 blockyMotionTable[] = {
+	  0,   0,  -1, -43,   6, -43,  -9, -42,  13, -41,
+	-16, -40,  19, -39, -23, -36,  26, -34,  -2, -33,
+	  4, -33, -29, -32,  -9, -32,  11, -31, -16, -29,
+	 32, -29,  18, -28, -34, -26, -22, -25,  -1, -25,
+	  3, -25,  -7, -24,   8, -24,  24, -23,  36, -23,
+	-12, -22,  13, -21, -38, -20,   0, -20, -27, -19,
+	 -4, -19,   4, -19, -17, -18,  -8, -17,   8, -17,
+	 18, -17,  28, -17,  39, -17, -12, -15,  12, -15,
+	-21, -14,  -1, -14,   1, -14, -41, -13,  -5, -13,
+	  5, -13,  21, -13, -31, -12, -15, -11,  -8, -11,
+	  8, -11,  15, -11,  -2, -10,   1, -10,  31, -10,
+	-23,  -9, -11,  -9,  -5,  -9,   4,  -9,  11,  -9,
+	 42,  -9,   6,  -8,  24,  -8, -18,  -7,  -7,  -7,
+	 -3,  -7,  -1,  -7,   2,  -7,  18,  -7, -43,  -6,
+	-13,  -6,  -4,  -6,   4,  -6,   8,  -6, -33,  -5,
+	 -9,  -5,  -2,  -5,   0,  -5,   2,  -5,   5,  -5,
+	 13,  -5, -25,  -4,  -6,  -4,  -3,  -4,   3,  -4,
+	  9,  -4, -19,  -3,  -7,  -3,  -4,  -3,  -2,  -3,
+	 -1,  -3,   0,  -3,   1,  -3,   2,  -3,   4,  -3,
+	  6,  -3,  33,  -3, -14,  -2, -10,  -2,  -5,  -2,
+	 -3,  -2,  -2,  -2,  -1,  -2,   0,  -2,   1,  -2,
+	  2,  -2,   3,  -2,   5,  -2,   7,  -2,  14,  -2,
+	 19,  -2,  25,  -2,  43,  -2,  -7,  -1,  -3,  -1,
+	 -2,  -1,  -1,  -1,   0,  -1,   1,  -1,   2,  -1,
+	  3,  -1,  10,  -1,  -5,   0,  -3,   0,  -2,   0,
+	 -1,   0,   1,   0,   2,   0,   3,   0,   5,   0,
+	  7,   0, -10,   1,  -7,   1,  -3,   1,  -2,   1,
+	 -1,   1,   0,   1,   1,   1,   2,   1,   3,   1,
+	-43,   2, -25,   2, -19,   2, -14,   2,  -5,   2,
+	 -3,   2,  -2,   2,  -1,   2,   0,   2,   1,   2,
+	  2,   2,   3,   2,   5,   2,   7,   2,  10,   2,
+	 14,   2, -33,   3,  -6,   3,  -4,   3,  -2,   3,
+	 -1,   3,   0,   3,   1,   3,   2,   3,   4,   3,
+	 19,   3,  -9,   4,  -3,   4,   3,   4,   7,   4,
+	 25,   4, -13,   5,  -5,   5,  -2,   5,   0,   5,
+	  2,   5,   5,   5,   9,   5,  33,   5,  -8,   6,
+	 -4,   6,   4,   6,  13,   6,  43,   6, -18,   7,
+	 -2,   7,   0,   7,   2,   7,   7,   7,  18,   7,
+	-24,   8,  -6,   8, -42,   9, -11,   9,  -4,   9,
+	  5,   9,  11,   9,  23,   9, -31,  10,  -1,  10,
+	  2,  10, -15,  11,  -8,  11,   8,  11,  15,  11,
+	 31,  12, -21,  13,  -5,  13,   5,  13,  41,  13,
+	 -1,  14,   1,  14,  21,  14, -12,  15,  12,  15,
+	-39,  17, -28,  17, -18,  17,  -8,  17,   8,  17,
+	 17,  18,  -4,  19,   0,  19,   4,  19,  27,  19,
+	 38,  20, -13,  21,  12,  22, -36,  23, -24,  23,
+	 -8,  24,   7,  24,  -3,  25,   1,  25,  22,  25,
+	 34,  26, -18,  28, -32,  29,  16,  29, -11,  31,
+	  9,  32,  29,  32,  -4,  33,   2,  33, -26,  34,
+	 23,  36, -19,  39,  16,  40, -13,  41,   9,  42,
+	 -6,  43,   1,  43,   0,   0,   0,   0,   0,   0,
+	  0,   0,   0
+};
+
+static BlockyPattern smallPatterns[256];
+static BlockyPattern bigPatterns[256];
+static bool smallPatternsReady = false;
+static bool bigPatternsReady = false;
+
+static void makePatterns(BlockyPattern *patterns, int param) {
+	int32 variable1, variable2;
+	int32 b1, b2;
+	int32 value_table47_1_2, value_table47_1_1, value_table47_2_2, value_table47_2_1;
+	int32 tableSmallBig[64], tmp;
+	const int8 *table47_1, *table47_2;
+	int32 *ptr_small_big;
+	int i, x, y;
+
+	if (param == 8) {
+		table47_1 = blockyTableBig1;
+		table47_2 = blockyTableBig2;
+	} else {
+		table47_1 = blockyTableSmall1;
+		table47_2 = blockyTableSmall2;
+	}
+
+	for (x = 0; x < 16; x++) {
+		value_table47_1_1 = table47_1[x];
+		value_table47_2_1 = table47_2[x];
+		for (y = 0; y < 16; y++) {
+			value_table47_1_2 = table47_1[y];
+			value_table47_2_2 = table47_2[y];
+
+			if (value_table47_2_1 == 0) {
+				b1 = 0;
+			} else if (value_table47_2_1 == param - 1) {
+				b1 = 1;
+			} else if (value_table47_1_1 == 0) {
+				b1 = 2;
+			} else if (value_table47_1_1 == param - 1) {
+				b1 = 3;
+			} else {
+				b1 = 4;
+			}
+
+			if (value_table47_2_2 == 0) {
+				b2 = 0;
+			} else if (value_table47_2_2 == param - 1) {
+				b2 = 1;
+			} else if (value_table47_1_2 == 0) {
+				b2 = 2;
+			} else if (value_table47_1_2 == param - 1) {
+				b2 = 3;
+			} else {
+				b2 = 4;
+			}
+
+			memset(tableSmallBig, 0, param * param * 4);
+
+			variable2 = ABS(value_table47_2_2 - value_table47_2_1);
+			tmp = ABS(value_table47_1_2 - value_table47_1_1);
+			if (variable2 <= tmp) {
+				variable2 = tmp;
+			}
+
+			for (variable1 = 0; variable1 <= variable2; variable1++) {
+				int32 variable3, variable4;
+
+				if (variable2 > 0) {
+					// Linearly interpolate between value_table47_1_1 and value_table47_1_2
+					// respectively value_table47_2_1 and value_table47_2_2.
+					variable4 = (value_table47_1_1 * variable1 + value_table47_1_2 * (variable2 - variable1) + variable2 / 2) / variable2;
+					variable3 = (value_table47_2_1 * variable1 + value_table47_2_2 * (variable2 - variable1) + variable2 / 2) / variable2;
+				} else {
+					variable4 = value_table47_1_1;
+					variable3 = value_table47_2_1;
+				}
+				ptr_small_big = &tableSmallBig[param * variable3 + variable4];
+				*ptr_small_big = 1;
+
+				if ((b1 == 2 && b2 == 3) || (b2 == 2 && b1 == 3) ||
+				    (b1 == 0 && b2 != 1) || (b2 == 0 && b1 != 1)) {
+					if (variable3 >= 0) {
+						i = variable3 + 1;
+						while (i--) {
+							*ptr_small_big = 1;
+							ptr_small_big -= param;
+						}
+					}
+				} else if ((b2 != 0 && b1 == 1) || (b1 != 0 && b2 == 1)) {
+					if (param > variable3) {
+						i = param - variable3;
+						while (i--) {
+							*ptr_small_big = 1;
+							ptr_small_big += param;
+						}
+					}
+				} else if ((b1 == 2 && b2 != 3) || (b2 == 2 && b1 != 3)) {
+					if (variable4 >= 0) {
+						i = variable4 + 1;
+						while (i--) {
+							*(ptr_small_big--) = 1;
+						}
+					}
+				} else if ((b1 == 0 && b2 == 1) || (b2 == 0 && b1 == 1) ||
+				           (b1 == 3 && b2 != 2) || (b2 == 3 && b1 != 2)) {
+					if (param > variable4) {
+						i = param - variable4;
+						while (i--) {
+							*(ptr_small_big++) = 1;
+						}
+					}
+				}
+			}
+
+			// Split the block into the pixels that get the first color and
+			// the ones that get the second color
+			BlockyPattern &pattern = patterns[x * 16 + y];
+			byte list1[64], list2[64];
+			pattern.count[0] = pattern.count[1] = 0;
+
+			for (i = param * param - 1; i >= 0; i--) {
+				if (tableSmallBig[i] != 0)
+					list1[pattern.count[0]++] = (byte)i;
+				else
+					list2[pattern.count[1]++] = (byte)i;
+			}
+
+			memcpy(pattern.pixels, list1, pattern.count[0]);
+			memcpy(pattern.pixels + pattern.count[0], list2, pattern.count[1]);
+		}
+	}
+}
+
+const BlockyPattern *getBlockyPatterns(int blockSize) {
+	if (blockSize == 8) {
+		if (!bigPatternsReady) {
+			makePatterns(bigPatterns, 8);
+			bigPatternsReady = true;
+		}
+
+		return bigPatterns;
+	}
+
+	if (!smallPatternsReady) {
+		makePatterns(smallPatterns, 4);
+		smallPatternsReady = true;
+	}
+
+	return smallPatterns;
+}
+
+typedef std::map<int, BlockyOffsets> BlockyOffsetsCache;
+static BlockyOffsetsCache offsetsCache;
+
+const BlockyOffsets *getBlockyOffsets(int width) {
+	BlockyOffsetsCache::iterator it = offsetsCache.find(width);
+	if (it != offsetsCache.end())
+		return &it->second;
+
+	BlockyOffsets &offsets = offsetsCache[width];
+
+	for (int l = 0; l < 512; l += 2)
+		offsets.motion[l / 2] = (int16)(blockyMotionTable[l + 1] * width + blockyMotionTable[l]);
+
+	// Convert the block patterns into offsets for this width
+	const BlockyPattern *small = getBlockyPatterns(4);
+	const BlockyPattern *big = getBlockyPatterns(8);
+
+	for (int i = 0; i < 256; i++) {
+		for (int j = 0; j < small[i].count[0] + small[i].count[1]; j++)
+			offsets.small[i][j] = (small[i].pixels[j] >> 2) * width + (small[i].pixels[j] & 3);
+
+		for (int j = 0; j < big[i].count[0] + big[i].count[1]; j++)
+			offsets.big[i][j] = (big[i].pixels[j] >> 3) * width + (big[i].pixels[j] & 7);
+	}
+
+	return &offsets;
+}
+
+const byte *loadInterpolationTable(byte *table, const byte *src) {
+	// Files tend to send the same table over and over again, so find the
+	// first row that actually changed
+	int firstRow = 0;
+	while (firstRow < 256 && memcmp(table + firstRow * 257, src, 256 - firstRow) == 0)
+		src += 256 - firstRow++;
+
+	if (firstRow == 256)
+		return src;
+
+	for (int y = firstRow; y < 256; y++) {
+		memcpy(table + y * 257, src, 256 - y);
+		src += 256 - y;
+	}
+
+	// Mirror the upper triangle into the lower one. This goes through the
+	// table in 16x16 tiles, so the column writes stay in the cache.
+	for (int tileY = firstRow & ~15; tileY < 256; tileY += 16) {
+		for (int tileX = tileY; tileX < 256; tileX += 16) {
+			for (int y = tileY; y < tileY + 16; y++) {
+				const byte *row = table + y * 256;
+
+				for (int x = MAX(tileX, y + 1); x < tileX + 16; x++)
+					table[x * 256 + y] = row[x];
+			}
+		}
+	}
+
+	return src;
+}
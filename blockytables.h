@@ -0,0 +1,96 @@
+/* smushplay - A simple LucasArts SMUSH video player
+ *
+ * smushplay is the legal property of its developers, whose names can be
+ * found in the AUTHORS file distributed with this source
+ * distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+// Based on the ScummVM and ResidualVM SMUSH code (GPLv2+ and LGPL v2.1,
+// respectively).
+
+#ifndef BLOCKYTABLES_H
+#define BLOCKYTABLES_H
+
+#include "types.h"
+
+/**
+ * Codec 47 and Blocky16 can fill a block with two colors following one of
+ * 256 predefined patterns. Each pattern splits the pixels of the block
+ * into two lists, one per color.
+ */
+struct BlockyPattern {
+	/** The number of pixels in each list */
+	byte count[2];
+
+	/**
+	 * The pixels of both lists (the first list followed by the second one),
+	 * as indices into the block (y * blockSize + x).
+	 */
+	byte pixels[64];
+};
+
+/**
+ * Get the 256 patterns for 4x4 (blockSize 4) or 8x8 (blockSize 8) blocks.
+ * The tables are generated on first use and then shared by all decoders.
+ */
+const BlockyPattern *getBlockyPatterns(int blockSize);
+
+/**
+ * How far a motion vector can move a block, in pixels, both horizontally
+ * and vertically.
+ */
+#define BLOCKY_MAX_MOTION 43
+
+/**
+ * How far an absolute offset can move a block, in pixels. The offsets
+ * are stored as int16, so this is the furthest either way.
+ */
+#define BLOCKY_MAX_OFFSET 32768
+
+/**
+ * The motion vectors and block patterns, converted to offsets for a frame
+ * of a given width.
+ */
+struct BlockyOffsets {
+	/** The motion vectors, as pixel offsets */
+	int16 motion[256];
+
+	/** The pixels of each 4x4 pattern, as offsets from the block's corner */
+	uint16 small[256][16];
+
+	/** The pixels of each 8x8 pattern, as offsets from the block's corner */
+	uint16 big[256][64];
+};
+
+/**
+ * Get the offsets for a frame width. Each width is only computed once,
+ * and the result is shared by all decoders for the rest of the process.
+ */
+const BlockyOffsets *getBlockyOffsets(int width);
+
+/**
+ * Load a codec 47/48 interpolation table. The 256x256 table is symmetric,
+ * so the stream only contains its upper triangle (32896 bytes), one row at
+ * a time. The table must have been zeroed before it's used for the first
+ * time. If the table already holds the same data, it is left alone.
+ *
+ * @return the data following the table in the stream
+ */
+const byte *loadInterpolationTable(byte *table, const byte *src);
+
+#endif
@@ -23,7 +23,9 @@
 // Based on the ScummVM code of the same name (GPLv2+)
 
 #include <assert.h>
+#include <map>
 #include <string.h>
+#include <vector>
 #include "codec37.h"
 #include "util.h"
 
@@ -31,30 +33,29 @@ Codec37Decoder::Codec37Decoder(int width, int height) {
 	_width = width;
 	_height = height;
 	_frameSize = _width * _height;
-	_deltaSize = _frameSize * 3 + 0x13600;
 
-	_deltaBuf = new byte[_deltaSize];
-	memset(_deltaBuf, 0, _deltaSize);
+	// The blocks cover whole 4x4 cells, so the buffers are padded out to
+	// them. Each buffer gets a guard band that covers the furthest offset
+	// in the tables (31 pixels either way) plus a block, so no block copy
+	// can leave the allocation.
+	int32 pitch = ((_width + 3) / 4) * 4;
+	_bufSize = pitch * ((_height + 3) / 4) * 4;
+	int32 guardSize = (31 + 4) * (pitch + 1);
+	_deltaBuf = allocateGuardedBuffers(_deltaBufs, 2, _bufSize, guardSize, _deltaSize);
 
-	_deltaBufs[0] = _deltaBuf + 0x4D80;
-	_deltaBufs[1] = _deltaBuf + 0xE880 + _frameSize;
-
-	_offsetTable = new int16[255];
+	_offsetTable = 0;
 
 	_curTable = 0;
 	_prevSeqNb = 0;
 	_tableLastPitch = -1;
 	_tableLastIndex = -1;
+
+	_dirtyBlocks = new byte[((_width + 3) / 4) * ((_height + 3) / 4)];
+	_allDirty = true;
+	_lastFrame = 0;
 }
 
 Codec37Decoder::~Codec37Decoder() {
-	if (_offsetTable) {
-		delete[] _offsetTable;
-		_offsetTable = 0;
-		_tableLastPitch = -1;
-		_tableLastIndex = -1;
-	}
-
 	if (_deltaBuf) {
 		delete[] _deltaBuf;
 		_deltaSize = 0;
@@ -62,8 +63,13 @@ Codec37Decoder::~Codec37Decoder() {
 		_deltaBufs[0] = 0;
 		_deltaBufs[1] = 0;
 	}
+
+	delete[] _dirtyBlocks;
 }
 
+typedef std::map<std::pair<int, int>, std::vector<int16> > OffsetTableCache;
+static OffsetTableCache offsetTables;
+
 void Codec37Decoder::makeTable(int pitch, int index) {
 	static const int8 table[] = {
 		0,   0,   1,   0,   2,   0,   3,   0,   5,   0,
@@ -226,26 +232,38 @@ void Codec37Decoder::makeTable(int pitch, int index) {
 
 	_tableLastPitch = pitch;
 	_tableLastIndex = index;
-	index *= 255;
-	assert(index + 254 < (int32)(sizeof(table) / 2));
 
-	for (int32 i = 0; i < 255; i++) {
-		int32 j = (i + index) * 2;
-		_offsetTable[i] = table[j + 1] * pitch + table[j];
+	// The offsets only depend on the pitch and the index, so they're built
+	// once and shared between all decoders
+	std::vector<int16> &offsets = offsetTables[std::make_pair(pitch, index)];
+
+	if (offsets.empty()) {
+		index *= 255;
+		assert(index + 254 < (int32)(sizeof(table) / 2));
+
+		// proc1() can look up code 0xFF when it's repeated by a fill, so
+		// there's an extra (zero) entry at the end
+		offsets.resize(256);
+		for (int32 i = 0; i < 255; i++) {
+			int32 j = (i + index) * 2;
+			offsets[i] = table[j + 1] * pitch + table[j];
+		}
 	}
+
+	_offsetTable = &offsets[0];
 }
 
+// Rows of a block are moved as whole 32-bit words. memcpy() keeps this
+// safe for unaligned rows, and compiles to a single load and store.
+
 #define WRITE_4X1_LINE(dst, v) \
 	do { \
-		for (int j = 0; j < 4; j++) \
-			(dst)[j] = v; \
+		uint32 line = (uint32)(v) * 0x01010101; \
+		memcpy(dst, &line, 4); \
 	} while (0)
 
 #define COPY_4X1_LINE(dst, src) \
-	do { \
-		for (int j = 0; j < 4; j++) \
-			(dst)[j] = (src)[j]; \
-	} while (0)
+	memcpy(dst, src, 4)
 
 // Fill a 4x4 pixel block with a literal pixel value
 
@@ -290,7 +308,7 @@ void Codec37Decoder::makeTable(int pitch, int index) {
 		dst += 4; \
 	} while (0)
 
-void Codec37Decoder::proc1(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, int16 *offset_table) {
+void Codec37Decoder::proc1(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, const int16 *offset_table) {
 	byte code;
 	bool filling, skipCode;
 	int32 len;
@@ -355,95 +373,45 @@ void Codec37Decoder::proc1(byte *dst, const byte *src, int32 nextOffs, int bw, i
 	}
 }
 
-void Codec37Decoder::proc3WithFDFE(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, int16 *offset_table) {
-	do {
-		int32 i = bw;
-		do {
-			int32 code = *src++;
-			if (code == 0xFD) {
-				LITERAL_4X4(src, dst, pitch);
-			} else if (code == 0xFE) {
-				LITERAL_4X1(src, dst, pitch);
-			} else if (code == 0xFF) {
-				LITERAL_1X1(src, dst, pitch);
-			} else {
-				byte *dst2 = dst + _offsetTable[code] + nextOffs;
-				COPY_4X4(dst2, dst, pitch);
-			}
-		} while (--i);
-		dst += pitch * 3;
-	} while (--bh);
-}
+template<bool hasFDFE, bool hasRLE>
+void Codec37Decoder::procBlocks(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch) {
+	// Frame type 3 is procBlocks<x, false>, frame type 4 is procBlocks<x, true>.
+	// Both come with and without the 0xFD/0xFE codes, so there's a separate
+	// copy of this loop for each combination.
+	const int16 *offsetTable = _offsetTable;
 
-void Codec37Decoder::proc3WithoutFDFE(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, int16 *offset_table) {
-	do {
-		int32 i = bw;
-		do {
-			int32 code = *src++;
-			if (code == 0xFF) {
-				LITERAL_1X1(src, dst, pitch);
-			} else {
-				byte *dst2 = dst + _offsetTable[code] + nextOffs;
-				COPY_4X4(dst2, dst, pitch);
-			}
-		} while (--i);
-		dst += pitch * 3;
-	} while (--bh);
-}
+	// Only copies from the same spot in the last frame leave a block as it was
+	byte *dirty = _dirtyBlocks;
+	bool dirtyCopy = !_offsetClean;
 
-void Codec37Decoder::proc4WithFDFE(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, int16 *offset_table) {
 	do {
 		int32 i = bw;
 		do {
 			int32 code = *src++;
-			if (code == 0xFD) {
+			if (hasFDFE && code == 0xFD) {
 				LITERAL_4X4(src, dst, pitch);
-			} else if (code == 0xFE) {
+				*dirty++ = 1;
+			} else if (hasFDFE && code == 0xFE) {
 				LITERAL_4X1(src, dst, pitch);
+				*dirty++ = 1;
 			} else if (code == 0xFF) {
 				LITERAL_1X1(src, dst, pitch);
-			} else if (code == 0x00) {
+				*dirty++ = 1;
+			} else if (hasRLE && code == 0x00) {
 				int32 length = *src++ + 1;
 				for (int32 l = 0; l < length; l++) {
 					byte *dst2 = dst + nextOffs;
 					COPY_4X4(dst2, dst, pitch);
+					*dirty++ = dirtyCopy;
 					i--;
 					if (i == 0) {
 						dst += pitch * 3;
 						bh--;
 						i = bw;
-					}
-				}
-				if (bh == 0) {
-					return;
-				}
-				i++;
-			} else {
-				byte *dst2 = dst + _offsetTable[code] + nextOffs;
-				COPY_4X4(dst2, dst, pitch);
-			}
-		} while (--i);
-		dst += pitch * 3;
-	} while (--bh);
-}
 
-void Codec37Decoder::proc4WithoutFDFE(byte *dst, const byte *src, int32 nextOffs, int bw, int bh, int pitch, int16 *offset_table) {
-	do {
-		int32 i = bw;
-		do {
-			int32 code = *src++;
-			if (code == 0xFF) {
-				LITERAL_1X1(src, dst, pitch);
-			} else if (code == 0x00) {
-				int32 length = *src++ + 1;
-				for (int32 l = 0; l < length; l++) {
-					byte *dst2 = dst + nextOffs;
-					COPY_4X4(dst2, dst, pitch);
-					i--;
-					if (i == 0) {
-						dst += pitch * 3;
-						bh--;
-						i = bw;
+						// A run can't go past the end of the frame
+						if (bh == 0)
+							break;
 					}
 				}
 				if (bh == 0) {
@@ -451,8 +419,9 @@ void Codec37Decoder::proc4WithoutFDFE(byte *dst, const byte *src, int32 nextOffs
 				}
 				i++;
 			} else {
-				byte *dst2 = dst + _offsetTable[code] + nextOffs;
+				byte *dst2 = dst + offsetTable[code] + nextOffs;
 				COPY_4X4(dst2, dst, pitch);
+				*dirty++ = dirtyCopy || offsetTable[code] != 0;
 			}
 		} while (--i);
 		dst += pitch * 3;
@@ -464,11 +433,16 @@ void Codec37Decoder::decode(byte *dst, const byte *src) {
 	int32 pitch = bw * 4;
 
 	int16 seq = READ_LE_UINT16(src + 2);
-	int32 decodedSize = READ_LE_UINT32(src + 4);
 	byte maskFlags = src[12];
 	makeTable(pitch, src[1]);
 	int32 tmp;
 
+	// The raw data can't be larger than a buffer
+	int32 decodedSize = MIN<uint32>(READ_LE_UINT32(src + 4), _bufSize);
+
+	// Only block coded frames can tell what changed
+	_allDirty = true;
+
 	switch (src[0]) {
 	case 0:
 		if ((_deltaBufs[_curTable] - _deltaBuf) > 0) {
@@ -502,30 +476,38 @@ void Codec37Decoder::decode(byte *dst, const byte *src) {
 			_curTable ^= 1;
 		}
 
+		_offsetClean = _deltaBufs[_curTable ^ 1] == _lastFrame;
+
 		if ((maskFlags & 4) != 0) {
-			proc3WithFDFE(_deltaBufs[_curTable], src + 16,
+			procBlocks<true, false>(_deltaBufs[_curTable], src + 16,
 										_deltaBufs[_curTable ^ 1] - _deltaBufs[_curTable], bw, bh,
-										pitch, _offsetTable);
+										pitch);
 		} else {
-			proc3WithoutFDFE(_deltaBufs[_curTable], src + 16,
+			procBlocks<false, false>(_deltaBufs[_curTable], src + 16,
 										_deltaBufs[_curTable ^ 1] - _deltaBufs[_curTable], bw, bh,
-										pitch, _offsetTable);
+										pitch);
 		}
+
+		_allDirty = false;
 		break;
 	case 4:
 		if ((seq & 1) || !(maskFlags & 1)) {
 			_curTable ^= 1;
 		}
 
+		_offsetClean = _deltaBufs[_curTable ^ 1] == _lastFrame;
+
 		if ((maskFlags & 4) != 0) {
-			proc4WithFDFE(_deltaBufs[_curTable], src + 16,
+			procBlocks<true, true>(_deltaBufs[_curTable], src + 16,
 										_deltaBufs[_curTable ^ 1] - _deltaBufs[_curTable], bw, bh,
-										pitch, _offsetTable);
+										pitch);
 		} else {
-			proc4WithoutFDFE(_deltaBufs[_curTable], src + 16,
+			procBlocks<false, true>(_deltaBufs[_curTable], src + 16,
 										_deltaBufs[_curTable ^ 1] - _deltaBufs[_curTable], bw, bh,
-										pitch, _offsetTable);
+										pitch);
 		}
+
+		_allDirty = false;
 		break;
 	default:
 		break;
@@ -533,6 +515,7 @@ void Codec37Decoder::decode(byte *dst, const byte *src) {
 	_prevSeqNb = seq;
 
 	memcpy(dst, _deltaBufs[_curTable], _frameSize);
+	_lastFrame = _deltaBufs[_curTable];
 }
 
 void Codec37Decoder::bompDecodeLine(byte *dst, const byte *src, int len) {
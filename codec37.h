@@ -34,25 +34,39 @@ public:
 
 	void decode(byte *dst, const byte *src);
 
+	/**
+	 * Get the 4x4 blocks that changed in the last decoded frame, compared
+	 * to the frame decoded before it. There is one byte per block, row by
+	 * row, which is non-zero if the block changed.
+	 *
+	 * @return the block map, or 0 if the whole frame has to be treated as
+	 * changed
+	 */
+	const byte *getDirtyBlocks() const { return _allDirty ? 0 : _dirtyBlocks; }
+
 private:
 	void makeTable(int, int);
-	void proc1(byte *dst, const byte *src, int32, int, int, int, int16 *);
-	void proc3WithFDFE(byte *dst, const byte *src, int32, int, int, int, int16 *);
-	void proc3WithoutFDFE(byte *dst, const byte *src, int32, int, int, int, int16 *);
-	void proc4WithFDFE(byte *dst, const byte *src, int32, int, int, int, int16 *);
-	void proc4WithoutFDFE(byte *dst, const byte *src, int32, int, int, int, int16 *);
+	void proc1(byte *dst, const byte *src, int32, int, int, int, const int16 *);
+	template<bool hasFDFE, bool hasRLE>
+	void procBlocks(byte *dst, const byte *src, int32, int, int, int);
 	void bompDecodeLine(byte *dst, const byte *src, int len);
 
 	int32 _deltaSize;
 	byte *_deltaBufs[2];
 	byte *_deltaBuf;
-	int16 *_offsetTable;
+	const int16 *_offsetTable;
 	int _curTable;
 	uint16 _prevSeqNb;
 	int _tableLastPitch;
 	int _tableLastIndex;
-	int32 _frameSize;
+	int32 _frameSize, _bufSize;
 	int _width, _height;
+
+	// Dirty blocks
+	byte *_dirtyBlocks;
+	bool _allDirty;
+	const byte *_lastFrame;
+	bool _offsetClean;
 };
 
 #endif
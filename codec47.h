@@ -27,37 +27,56 @@
 
 #include "types.h"
 
+struct BlockyOffsets;
+struct BlockyPattern;
+
 class Codec47Decoder {
 public:
 	Codec47Decoder(int width, int height);
 	~Codec47Decoder();
 	bool decode(byte *dst, const byte *src);
 
+	/**
+	 * Get the 8x8 blocks that changed in the last decoded frame, compared
+	 * to the frame decoded before it. There is one byte per block, row by
+	 * row, which is non-zero if the block changed.
+	 *
+	 * @return the block map, or 0 if the whole frame has to be treated as
+	 * changed
+	 */
+	const byte *getDirtyBlocks() const { return _allDirty ? 0 : _dirtyBlocks; }
+
 private:
-	void makeTablesInterpolation(int param);
-	void makeTables47(int width);
-	void level1(byte *d_dst);
+	bool level1(byte *d_dst);
 	void level2(byte *d_dst);
 	void level3(byte *d_dst);
 	void decode2(byte *dst, const byte *src, int width, int height, const byte *paramPtr);
 	void bompDecodeLine(byte *dst, const byte *src, int len);
 	void scaleFrame(byte *dst, const byte *src);
+	byte *findFreeBuffer(const byte *used1, const byte *used2) const;
+	void prepareCurBuf(bool keepContents);
+	void setRepeatedDirty();
 
 	int32 _deltaSize;
+	byte *_bufs[3];
 	byte *_deltaBufs[2];
 	byte *_deltaBuf;
 	byte *_curBuf;
 	int32 _prevSeqNb;
-	int _lastTableWidth;
 	const byte *_d_src, *_paramPtr;
 	int _d_pitch;
 	int32 _offset1, _offset2;
-	byte *_tableBig;
-	byte *_tableSmall;
-	int16 _table[256];
+	const BlockyPattern *_patternsSmall, *_patternsBig;
+	const BlockyOffsets *_offsets;
 	int32 _frameSize;
 	int _width, _height;
 	byte *_interTable;
+
+	// Dirty blocks
+	byte *_dirtyBlocks;
+	bool _allDirty;
+	const byte *_lastFrame;
+	bool _offset1Clean, _offset2Clean;
 };
 
 #endif
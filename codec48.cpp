@@ -21,8 +21,11 @@
  */
 
 #include <assert.h>
+#include <map>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#include "blockytables.h"
 #include "codec48.h"
 #include "util.h"
 
@@ -37,23 +40,34 @@ Codec48Decoder::Codec48Decoder(int width, int height) {
 	// don't support when this is not equal yet
 	assert(_width == _pitch);
 
-	_frameSize = 640 * 480; // Yes, this is correct. Looks like the buffers are always this size
+	_frameSize = _pitch * _blockY * 8;
+
+	// Every buffer gets a guard band that covers the furthest a block can
+	// be copied from, plus a block, so no block copy can leave the
+	// allocation. A motion vector moves a block up to BLOCKY_MAX_MOTION
+	// rows and columns, and an absolute offset up to BLOCKY_MAX_OFFSET
+	// pixels.
+	int32 reach = MAX<int32>(BLOCKY_MAX_MOTION * (_pitch + 1), BLOCKY_MAX_OFFSET);
+	int32 guardSize = reach + 8 * (_pitch + 1);
 
 	_curBuf = 0;
-	_deltaBuf[0] = new byte[_frameSize * 2];
-	_deltaBuf[1] = _deltaBuf[0] + _frameSize;
+	_bufAlloc = allocateGuardedBuffers(_deltaBuf, 2, _frameSize, guardSize, _bufAllocSize);
 
-	_offsetTable = new int16[255];
+	_offsetTable = 0;
 	_tableLastPitch = -1;
 	_tableLastIndex = -1;
 
 	_interTable = 0;
+
+	_dirtyBlocks = new byte[_blockX * _blockY];
+	_allDirty = true;
+	_lastFrame = 0;
 }
 
 Codec48Decoder::~Codec48Decoder() {
-	delete[] _deltaBuf[0];
-	delete[] _offsetTable;
+	delete[] _bufAlloc;
 	delete[] _interTable;
+	delete[] _dirtyBlocks;
 }
 
 bool Codec48Decoder::decode(byte *dst, const byte *src) {
@@ -65,35 +79,26 @@ bool Codec48Decoder::decode(byte *dst, const byte *src) {
 
 	int16 seqNb = READ_LE_UINT16(src + 2);
 
-	if (seqNb == 0)
-		memset(_deltaBuf[0], 0, _frameSize * 2);
+	// Only block coded frames can tell what changed
+	_allDirty = true;
+
+	if (seqNb == 0) {
+		memset(_bufAlloc, 0, _bufAllocSize);
+		_lastFrame = 0;
+	}
 
 	if (src[12] & (1 << 3)) {
 		// Interpolation table present
 		if (!_interTable)
-			_interTable = new byte[65536];
-
-		byte *ptr = _interTable;
-
-		for (int i = 0; i < 256; i++) {
-			byte *ptr1 = ptr + i;
-			byte *ptr2 = ptr + i;
-
-			for (int j = 256 - i; j > 0; j--) {
-				byte pixel = *gfxData++;
-				*ptr2 = pixel;
-				*ptr1++ = pixel;
-				ptr2 += 256;
-			}
+			_interTable = new byte[65536]();
 
-			ptr += 256;
-		}
+		gfxData = loadInterpolationTable(_interTable, gfxData);
 	}
 
 	switch (src[0]) {
 	case 0:
 		// Raw frame
-		memcpy(_deltaBuf[_curBuf], gfxData, READ_LE_UINT32(src + 4));
+		memcpy(_deltaBuf[_curBuf], gfxData, MIN<uint32>(READ_LE_UINT32(src + 4), _frameSize));
 		break;
 	case 2:
 		// Blast object
@@ -105,7 +110,9 @@ bool Codec48Decoder::decode(byte *dst, const byte *src) {
 			if (seqNb & 1 || !(src[12] & 1) || src[12] & 0x10)
 				_curBuf ^= 1;
 
+			_offsetClean = _deltaBuf[_curBuf ^ 1] == _lastFrame;
 			decode3(_deltaBuf[_curBuf], gfxData, _deltaBuf[_curBuf ^ 1] - _deltaBuf[_curBuf]);
+			_allDirty = false;
 		}
 		break;
 	case 5:
@@ -119,6 +126,7 @@ bool Codec48Decoder::decode(byte *dst, const byte *src) {
 
 	_prevSeqNb = seqNb;
 	memcpy(dst, _deltaBuf[_curBuf], _pitch * _height);
+	_lastFrame = _deltaBuf[_curBuf];
 	return true;
 }
 
@@ -144,6 +152,9 @@ void Codec48Decoder::bompDecodeLine(byte *dst, const byte *src, int len) {
 	}
 }
 
+typedef std::map<std::pair<int, int>, std::vector<int16> > OffsetTableCache;
+static OffsetTableCache offsetTables;
+
 void Codec48Decoder::makeTable(int pitch, int index) {
 	// codec48's table is codec47's table appended by the first
 	// part of codec37's table
@@ -260,54 +271,91 @@ void Codec48Decoder::makeTable(int pitch, int index) {
 
 	_tableLastPitch = pitch;
 	_tableLastIndex = index;
-	index *= 255;
-	assert(index + 254 < (int32)(sizeof(table) / 2));
 
-	for (int32 i = 0; i < 255; i++) {
-		int32 j = (i + index) * 2;
-		_offsetTable[i] = table[j + 1] * pitch + table[j];
+	// The offsets only depend on the pitch and the index, so they're built
+	// once and shared between all decoders
+	std::vector<int16> &offsets = offsetTables[std::make_pair(pitch, index)];
+
+	if (offsets.empty()) {
+		index *= 255;
+		assert(index + 254 < (int32)(sizeof(table) / 2));
+
+		// The sub-block opcodes can look up code 0xFF, so there's an extra
+		// (zero) entry at the end
+		offsets.resize(256);
+		for (int32 i = 0; i < 255; i++) {
+			int32 j = (i + index) * 2;
+			offsets[i] = table[j + 1] * pitch + table[j];
+		}
 	}
+
+	_offsetTable = &offsets[0];
+}
+
+// Copy a size x size block from src to dst. The rows are copied with a
+// fixed size memcpy() so the compiler can turn them into single loads and
+// stores without caring about alignment.
+template<int size>
+static inline void copyBlock(byte *dst, const byte *src, int pitch) {
+	for (int i = 0; i < size; i++)
+		memcpy(dst + pitch * i, src + pitch * i, size);
 }
 
 void Codec48Decoder::decode3(byte *dst, const byte *src, int bufOffset) {
+	const byte *interTable = _interTable;
+
+	// Only copies from the same spot in the last frame leave a block as it was
+	byte *dirty = _dirtyBlocks;
+	bool dirtyCopy = !_offsetClean;
+
 	for (int i = 0; i < _blockY; i++) {
 		for (int j = 0; j < _blockX; j++) {
 			byte opcode = *src++;
-			
+			bool changed = true;
 
 			switch (opcode) {
 			case 0xFF: {
 				// Interpolate a 4x4 block based on 1 pixel, then scale to 8x8
+				// The pixels to the top and to the left of the block are only
+				// read once, which leaves the table lookups as the only
+				// dependencies between the four rows.
+				uint top = dst[-_pitch + 7] << 8;
+				uint left0 = dst[-1] << 8;
+				uint left1 = dst[_pitch * 2 - 1] << 8;
+				uint left2 = dst[_pitch * 3 - 1] << 8;
+				uint left3 = dst[_pitch * 4 - 1] << 8;
+
 				byte scaleBuffer[16];
 				scaleBuffer[15] = *src++;
-				scaleBuffer[7] = _interTable[(dst[-_pitch + 7] << 8) | scaleBuffer[15]];
-				scaleBuffer[3] = _interTable[(dst[-_pitch + 7] << 8) | scaleBuffer[7]];
-				scaleBuffer[11] = _interTable[(scaleBuffer[15] << 8) | scaleBuffer[7]];
-
-				scaleBuffer[1] = _interTable[(dst[-1] << 8) | scaleBuffer[3]];
-				scaleBuffer[0] = _interTable[(dst[-1] << 8) | scaleBuffer[1]];
-				scaleBuffer[2] = _interTable[(scaleBuffer[3] << 8) | scaleBuffer[1]];
-
-				scaleBuffer[5] = _interTable[(dst[_pitch * 2 - 1] << 8) | scaleBuffer[7]];
-				scaleBuffer[4] = _interTable[(dst[_pitch * 2 - 1] << 8) | scaleBuffer[5]];
-				scaleBuffer[6] = _interTable[(scaleBuffer[7] << 8) | scaleBuffer[5]];
-
-				scaleBuffer[9] = _interTable[(dst[_pitch * 3 - 1] << 8) | scaleBuffer[11]];
-				scaleBuffer[8] = _interTable[(dst[_pitch * 3 - 1] << 8) | scaleBuffer[9]];
-				scaleBuffer[10] = _interTable[(scaleBuffer[11] << 8) | scaleBuffer[9]];
-
-				scaleBuffer[13] = _interTable[(dst[_pitch * 4 - 1] << 8) | scaleBuffer[15]];
-				scaleBuffer[12] = _interTable[(dst[_pitch * 4 - 1] << 8) | scaleBuffer[13]];
-				scaleBuffer[14] = _interTable[(scaleBuffer[15] << 8) | scaleBuffer[13]];
+				scaleBuffer[7] = interTable[top | scaleBuffer[15]];
+				scaleBuffer[3] = interTable[top | scaleBuffer[7]];
+				scaleBuffer[11] = interTable[(scaleBuffer[15] << 8) | scaleBuffer[7]];
+
+				scaleBuffer[1] = interTable[left0 | scaleBuffer[3]];
+				scaleBuffer[5] = interTable[left1 | scaleBuffer[7]];
+				scaleBuffer[9] = interTable[left2 | scaleBuffer[11]];
+				scaleBuffer[13] = interTable[left3 | scaleBuffer[15]];
+
+				scaleBuffer[0] = interTable[left0 | scaleBuffer[1]];
+				scaleBuffer[2] = interTable[(scaleBuffer[3] << 8) | scaleBuffer[1]];
+				scaleBuffer[4] = interTable[left1 | scaleBuffer[5]];
+				scaleBuffer[6] = interTable[(scaleBuffer[7] << 8) | scaleBuffer[5]];
+				scaleBuffer[8] = interTable[left2 | scaleBuffer[9]];
+				scaleBuffer[10] = interTable[(scaleBuffer[11] << 8) | scaleBuffer[9]];
+				scaleBuffer[12] = interTable[left3 | scaleBuffer[13]];
+				scaleBuffer[14] = interTable[(scaleBuffer[15] << 8) | scaleBuffer[13]];
 
 				scaleBlock(dst, scaleBuffer);
 				break;
 			}
-			case 0xFE:
+			case 0xFE: {
 				// Copy a block using an absolute offset
-				copyBlock(dst, bufOffset, (int16)READ_LE_UINT16(src));
+				int16 offset = READ_LE_UINT16(src);
+				copyBlock<8>(dst, dst + bufOffset + offset, _pitch);
+				changed = dirtyCopy || offset != 0;
 				src += 2;
 				break;
+			}
 			case 0xFD: {
 				// Interpolate a 4x4 block based on 4 pixels, then scale to 8x8
 				byte scaleBuffer[16];
@@ -316,21 +364,21 @@ void Codec48Decoder::decode3(byte *dst, const byte *src, int bufOffset) {
 				scaleBuffer[13] = src[2];
 				scaleBuffer[15] = src[3];
 
-				scaleBuffer[1] = _interTable[(dst[-_pitch + 3] << 8) | scaleBuffer[5]];
-				scaleBuffer[3] = _interTable[(dst[-_pitch + 7] << 8) | scaleBuffer[7]];
-				scaleBuffer[11] = _interTable[(scaleBuffer[15] << 8) | scaleBuffer[7]];
-				scaleBuffer[9] = _interTable[(scaleBuffer[13] << 8) | scaleBuffer[5]];
-
-				scaleBuffer[0] = _interTable[(dst[-1] << 8) | scaleBuffer[1]];
-				scaleBuffer[2] = _interTable[(scaleBuffer[3] << 8) | scaleBuffer[1]];
-				scaleBuffer[4] = _interTable[(dst[_pitch * 2 - 1] << 8) | scaleBuffer[5]];
-				scaleBuffer[6] = _interTable[(scaleBuffer[7] << 8) | scaleBuffer[5]];
-
-				scaleBuffer[8] = _interTable[(dst[_pitch * 3 - 1] << 8) | scaleBuffer[9]];
-				scaleBuffer[10] = _interTable[(scaleBuffer[11] << 8) | scaleBuffer[9]];
-				scaleBuffer[12] = _interTable[(dst[_pitch * 4 - 1] << 8) | scaleBuffer[13]];
-				scaleBuffer[14] = _interTable[(scaleBuffer[15] << 8) | scaleBuffer[13]];
-				
+				scaleBuffer[1] = interTable[(dst[-_pitch + 3] << 8) | scaleBuffer[5]];
+				scaleBuffer[3] = interTable[(dst[-_pitch + 7] << 8) | scaleBuffer[7]];
+				scaleBuffer[11] = interTable[(scaleBuffer[15] << 8) | scaleBuffer[7]];
+				scaleBuffer[9] = interTable[(scaleBuffer[13] << 8) | scaleBuffer[5]];
+
+				scaleBuffer[0] = interTable[(dst[-1] << 8) | scaleBuffer[1]];
+				scaleBuffer[2] = interTable[(scaleBuffer[3] << 8) | scaleBuffer[1]];
+				scaleBuffer[4] = interTable[(dst[_pitch * 2 - 1] << 8) | scaleBuffer[5]];
+				scaleBuffer[6] = interTable[(scaleBuffer[7] << 8) | scaleBuffer[5]];
+
+				scaleBuffer[8] = interTable[(dst[_pitch * 3 - 1] << 8) | scaleBuffer[9]];
+				scaleBuffer[10] = interTable[(scaleBuffer[11] << 8) | scaleBuffer[9]];
+				scaleBuffer[12] = interTable[(dst[_pitch * 4 - 1] << 8) | scaleBuffer[13]];
+				scaleBuffer[14] = interTable[(scaleBuffer[15] << 8) | scaleBuffer[13]];
+
 				scaleBlock(dst, scaleBuffer);
 
 				src += 4;
@@ -338,49 +386,20 @@ void Codec48Decoder::decode3(byte *dst, const byte *src, int bufOffset) {
 			}
 			case 0xFC:
 				// Copy 4 4x4 blocks using the offset table
-				*((uint32 *)dst) = *((uint32 *)(dst + bufOffset + _offsetTable[src[0]]));
-				*((uint32 *)(dst + _pitch)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[0]] + _pitch));
-				*((uint32 *)(dst + _pitch * 2)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[0]] + _pitch * 2));
-				*((uint32 *)(dst + _pitch * 3)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[0]] + _pitch * 3));
-
-				*((uint32 *)(dst + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[1]] + 4));
-				*((uint32 *)(dst + _pitch + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[1]] + _pitch + 4));
-				*((uint32 *)(dst + _pitch * 2 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[1]] + _pitch * 2 + 4));
-				*((uint32 *)(dst + _pitch * 3 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[1]] + _pitch * 3 + 4));
-
-				*((uint32 *)(dst + _pitch * 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[2]] + _pitch * 4));
-				*((uint32 *)(dst + _pitch * 5)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[2]] + _pitch * 5));
-				*((uint32 *)(dst + _pitch * 6)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[2]] + _pitch * 6));
-				*((uint32 *)(dst + _pitch * 7)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[2]] + _pitch * 7));
-
-				*((uint32 *)(dst + _pitch * 4 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[3]] + _pitch * 4 + 4));
-				*((uint32 *)(dst + _pitch * 5 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[3]] + _pitch * 5 + 4));
-				*((uint32 *)(dst + _pitch * 6 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[3]] + _pitch * 6 + 4));
-				*((uint32 *)(dst + _pitch * 7 + 4)) = *((uint32 *)(dst + bufOffset + _offsetTable[src[3]] + _pitch * 7 + 4));
+				for (int k = 0; k < 4; k++) {
+					byte *block = dst + (k >> 1) * 4 * _pitch + (k & 1) * 4;
+					copyBlock<4>(block, block + bufOffset + _offsetTable[src[k]], _pitch);
+				}
 
 				src += 4;
 				break;
 			case 0xFB:
 				// Copy 4 4x4 blocks using absolute offsets
-				*((uint32 *)dst) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src)));
-				*((uint32 *)(dst + _pitch)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src) + _pitch));
-				*((uint32 *)(dst + _pitch * 2)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src) + _pitch * 2));
-				*((uint32 *)(dst + _pitch * 3)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src) + _pitch * 3));
-
-				*((uint32 *)(dst + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + 4));
-				*((uint32 *)(dst + _pitch + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + _pitch + 4));
-				*((uint32 *)(dst + _pitch * 2 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + _pitch * 2 + 4));
-				*((uint32 *)(dst + _pitch * 3 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + _pitch * 3 + 4));
-
-				*((uint32 *)(dst + _pitch * 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + _pitch * 4));
-				*((uint32 *)(dst + _pitch * 5)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + _pitch * 5));
-				*((uint32 *)(dst + _pitch * 6)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + _pitch * 6));
-				*((uint32 *)(dst + _pitch * 7)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + _pitch * 7));
-
-				*((uint32 *)(dst + _pitch * 4 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + _pitch * 4 + 4));
-				*((uint32 *)(dst + _pitch * 5 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + _pitch * 5 + 4));
-				*((uint32 *)(dst + _pitch * 6 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + _pitch * 6 + 4));
-				*((uint32 *)(dst + _pitch * 7 + 4)) = *((uint32 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + _pitch * 7 + 4));
+				for (int k = 0; k < 4; k++) {
+					byte *block = dst + (k >> 1) * 4 * _pitch + (k & 1) * 4;
+					copyBlock<4>(block, block + bufOffset + (int16)READ_LE_UINT16(src + k * 2), _pitch);
+				}
+
 				src += 8;
 				break;
 			case 0xFA:
@@ -390,134 +409,37 @@ void Codec48Decoder::decode3(byte *dst, const byte *src, int bufOffset) {
 				break;
 			case 0xF9:
 				// Copy 16 2x2 blocks using the offset table
-				*((uint16 *)dst) = *((uint16 *)(dst + bufOffset + _offsetTable[src[0]]));
-				*((uint16 *)(dst + _pitch)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[0]] + _pitch));
-
-				*((uint16 *)(dst + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[1]] + 2));
-				*((uint16 *)(dst + _pitch + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[1]] + _pitch + 2));
-
-				*((uint16 *)(dst + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[2]] + 4));
-				*((uint16 *)(dst + _pitch + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[2]] + _pitch + 4));
+				for (int k = 0; k < 16; k++) {
+					byte *block = dst + (k >> 2) * 2 * _pitch + (k & 3) * 2;
+					copyBlock<2>(block, block + bufOffset + _offsetTable[src[k]], _pitch);
+				}
 
-				*((uint16 *)(dst + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[3]] + 6));
-				*((uint16 *)(dst + _pitch + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[3]] + _pitch + 6));
-
-				*((uint16 *)(dst + _pitch * 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[4]] + _pitch * 2));
-				*((uint16 *)(dst + _pitch * 3)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[4]] + _pitch * 3));
-
-				*((uint16 *)(dst + _pitch * 2 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[5]] + _pitch * 2 + 2));
-				*((uint16 *)(dst + _pitch * 3 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[5]] + _pitch * 3 + 2));
-
-				*((uint16 *)(dst + _pitch * 2 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[6]] + _pitch * 2 + 4));
-				*((uint16 *)(dst + _pitch * 3 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[6]] + _pitch * 3 + 4));
-
-				*((uint16 *)(dst + _pitch * 2 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[7]] + _pitch * 2 + 6));
-				*((uint16 *)(dst + _pitch * 3 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[7]] + _pitch * 3 + 6));
-
-				*((uint16 *)(dst + _pitch * 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[8]] + _pitch * 4));
-				*((uint16 *)(dst + _pitch * 5)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[8]] + _pitch * 5));
-
-				*((uint16 *)(dst + _pitch * 4 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[9]] + _pitch * 4 + 2));
-				*((uint16 *)(dst + _pitch * 5 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[9]] + _pitch * 5 + 2));
-
-				*((uint16 *)(dst + _pitch * 4 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[10]] + _pitch * 4 + 4));
-				*((uint16 *)(dst + _pitch * 5 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[10]] + _pitch * 5 + 4));
-
-				*((uint16 *)(dst + _pitch * 4 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[11]] + _pitch * 4 + 6));
-				*((uint16 *)(dst + _pitch * 5 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[11]] + _pitch * 5 + 6));
-
-				*((uint16 *)(dst + _pitch * 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[12]] + _pitch * 6));
-				*((uint16 *)(dst + _pitch * 7)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[12]] + _pitch * 7));
-
-				*((uint16 *)(dst + _pitch * 6 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[13]] + _pitch * 6 + 2));
-				*((uint16 *)(dst + _pitch * 7 + 2)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[13]] + _pitch * 7 + 2));
-
-				*((uint16 *)(dst + _pitch * 6 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[14]] + _pitch * 6 + 4));
-				*((uint16 *)(dst + _pitch * 7 + 4)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[14]] + _pitch * 7 + 4));
-
-				*((uint16 *)(dst + _pitch * 6 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[15]] + _pitch * 6 + 6));
-				*((uint16 *)(dst + _pitch * 7 + 6)) = *((uint16 *)(dst + bufOffset + _offsetTable[src[15]] + _pitch * 7 + 6));
 				src += 16;
 				break;
 			case 0xF8:
 				// Copy 16 2x2 blocks using absolute offsets
-				*((uint16 *)dst) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src)));
-				*((uint16 *)(dst + _pitch)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src) + _pitch));
-		
-				*((uint16 *)(dst + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + 2));
-				*((uint16 *)(dst + _pitch + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 2) + _pitch + 2));
-
-				*((uint16 *)(dst + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + 4));
-				*((uint16 *)(dst + _pitch + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 4) + _pitch + 4));
-
-				*((uint16 *)(dst + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + 6));
-				*((uint16 *)(dst + _pitch + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 6) + _pitch + 6));
-
-				*((uint16 *)(dst + _pitch * 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 8) + _pitch * 2));
-				*((uint16 *)(dst + _pitch * 3)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 8) + _pitch * 3));
-
-				*((uint16 *)(dst + _pitch * 2 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 10) + _pitch * 2 + 2));
-				*((uint16 *)(dst + _pitch * 3 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 10) + _pitch * 3 + 2));
-
-				*((uint16 *)(dst + _pitch * 2 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 12) + _pitch * 2 + 4));
-				*((uint16 *)(dst + _pitch * 3 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 12) + _pitch * 3 + 4));
-
-				*((uint16 *)(dst + _pitch * 2 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 14) + _pitch * 2 + 6));
-				*((uint16 *)(dst + _pitch * 3 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 14) + _pitch * 3 + 6));
-
-				*((uint16 *)(dst + _pitch * 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 16) + _pitch * 4));
-				*((uint16 *)(dst + _pitch * 5)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 16) + _pitch * 5));
-
-				*((uint16 *)(dst + _pitch * 4 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 18) + _pitch * 4 + 2));
-				*((uint16 *)(dst + _pitch * 5 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 18) + _pitch * 5 + 2));
-
-				*((uint16 *)(dst + _pitch * 4 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 20) + _pitch * 4 + 4));
-				*((uint16 *)(dst + _pitch * 5 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 20) + _pitch * 5 + 4));
-
-				*((uint16 *)(dst + _pitch * 4 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 22) + _pitch * 4 + 6));
-				*((uint16 *)(dst + _pitch * 5 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 22) + _pitch * 5 + 6));
-
-				*((uint16 *)(dst + _pitch * 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 24) + _pitch * 6));
-				*((uint16 *)(dst + _pitch * 7)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 24) + _pitch * 7));
-
-				*((uint16 *)(dst + _pitch * 6 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 26) + _pitch * 6 + 2));
-				*((uint16 *)(dst + _pitch * 7 + 2)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 26) + _pitch * 7 + 2));
-
-				*((uint16 *)(dst + _pitch * 6 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 28) + _pitch * 6 + 4));
-				*((uint16 *)(dst + _pitch * 7 + 4)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 28) + _pitch * 7 + 4));
-
-				*((uint16 *)(dst + _pitch * 6 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 30) + _pitch * 6 + 6));
-				*((uint16 *)(dst + _pitch * 7 + 6)) = *((uint16 *)(dst + bufOffset + (int16)READ_LE_UINT16(src + 30) + _pitch * 7 + 6));
+				for (int k = 0; k < 16; k++) {
+					byte *block = dst + (k >> 2) * 2 * _pitch + (k & 3) * 2;
+					copyBlock<2>(block, block + bufOffset + (int16)READ_LE_UINT16(src + k * 2), _pitch);
+				}
 
 				src += 32;
 				break;
 			case 0xF7:
 				// Raw 8x8 block
-				*((uint32 *)dst) = *((uint32 *)src);
-				*((uint32 *)(dst + 4)) = *((uint32 *)(src + 4));
-				*((uint32 *)(dst + _pitch)) = *((uint32 *)(src + 8));
-				*((uint32 *)(dst + _pitch + 4)) = *((uint32 *)(src + 12));
-				*((uint32 *)(dst + _pitch * 2)) = *((uint32 *)(src + 16));
-				*((uint32 *)(dst + _pitch * 2 + 4)) = *((uint32 *)(src + 20));
-				*((uint32 *)(dst + _pitch * 3)) = *((uint32 *)(src + 24));
-				*((uint32 *)(dst + _pitch * 3 + 4)) = *((uint32 *)(src + 28));
-				*((uint32 *)(dst + _pitch * 4)) = *((uint32 *)(src + 32));
-				*((uint32 *)(dst + _pitch * 4 + 4)) = *((uint32 *)(src + 36));
-				*((uint32 *)(dst + _pitch * 5)) = *((uint32 *)(src + 40));
-				*((uint32 *)(dst + _pitch * 5 + 4)) = *((uint32 *)(src + 44));
-				*((uint32 *)(dst + _pitch * 6)) = *((uint32 *)(src + 48));
-				*((uint32 *)(dst + _pitch * 6 + 4)) = *((uint32 *)(src + 52));
-				*((uint32 *)(dst + _pitch * 7)) = *((uint32 *)(src + 56));
-				*((uint32 *)(dst + _pitch * 7 + 4)) = *((uint32 *)(src + 60));
+				for (int k = 0; k < 8; k++)
+					memcpy(dst + _pitch * k, src + k * 8, 8);
 
 				src += 64;
 				break;
 			default:
 				// Copy a block using the offset table
-				copyBlock(dst, bufOffset, _offsetTable[opcode]);
+				copyBlock<8>(dst, dst + bufOffset + _offsetTable[opcode], _pitch);
+				changed = dirtyCopy || _offsetTable[opcode] != 0;
 				break;
 			}
 
+			*dirty++ = changed;
 			dst += 8;
 		}
 
@@ -525,35 +447,19 @@ void Codec48Decoder::decode3(byte *dst, const byte *src, int bufOffset) {
 	}
 }
 
-void Codec48Decoder::copyBlock(byte *dst, int deltaBufOffset, int offset) {
-	const byte *src = dst + deltaBufOffset + offset;
-
-	for (int i = 0; i < 8; i++) {
-		*((uint32 *)(dst + _pitch * i)) = *((uint32 *)(src + _pitch * i));
-		*((uint32 *)(dst + _pitch * i + 4)) = *((uint32 *)(src + _pitch * i + 4));
-	}
-}
-
 void Codec48Decoder::scaleBlock(byte *dst, const byte *src) {
-	// This is doing a 2x scale of data
+	// This is doing a 2x scale of data. Each row of the 4x4 block is widened
+	// into a full 8 pixel row once, and then stored twice.
 
 	for (int i = 0; i < 4; i++) {
-		uint16 pixels = src[0];
-		pixels = (pixels << 8) | pixels;
-		*((uint16 *)dst) = pixels;
-		*((uint16 *)(dst + _pitch)) = pixels;
-		pixels = src[1];
-		pixels = (pixels << 8) | pixels;
-		*((uint16 *)(dst + 2)) = pixels;
-		*((uint16 *)(dst + _pitch + 2)) = pixels;
-		pixels = src[2];
-		pixels = (pixels << 8) | pixels;
-		*((uint16 *)(dst + 4)) = pixels;
-		*((uint16 *)(dst + _pitch + 4)) = pixels;
-		pixels = src[3];
-		pixels = (pixels << 8) | pixels;
-		*((uint16 *)(dst + 6)) = pixels;
-		*((uint16 *)(dst + _pitch + 6)) = pixels;
+		byte row[8];
+		row[0] = row[1] = src[0];
+		row[2] = row[3] = src[1];
+		row[4] = row[5] = src[2];
+		row[6] = row[7] = src[3];
+
+		memcpy(dst, row, 8);
+		memcpy(dst + _pitch, row, 8);
 		src += 4;
 		dst += _pitch * 2;
 	}
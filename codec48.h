@@ -31,6 +31,16 @@ public:
 	~Codec48Decoder();
 	bool decode(byte *dst, const byte *src);
 
+	/**
+	 * Get the 8x8 blocks that changed in the last decoded frame, compared
+	 * to the frame decoded before it. There is one byte per block, row by
+	 * row, which is non-zero if the block changed.
+	 *
+	 * @return the block map, or 0 if the whole frame has to be treated as
+	 * changed
+	 */
+	const byte *getDirtyBlocks() const { return _allDirty ? 0 : _dirtyBlocks; }
+
 private:
 	void makeTable(int pitch, int index);
 
@@ -38,18 +48,25 @@ private:
 
 	void decode3(byte *dst, const byte *src, int bufOffset);
 	void scaleBlock(byte *dst, const byte *src);
-	void copyBlock(byte *dst, int deltaBufOffset, int offset);
 
 	int _curBuf;
 	byte *_deltaBuf[2];
+	byte *_bufAlloc;
+	int32 _bufAllocSize;
 	int _blockX, _blockY;
 	int _pitch;
-	int16 *_offsetTable;
+	const int16 *_offsetTable;
 	int _tableLastPitch, _tableLastIndex;
 	int16 _prevSeqNb;
 	int32 _frameSize;
 	int _width, _height;
 	byte *_interTable;
+
+	// Dirty blocks
+	byte *_dirtyBlocks;
+	bool _allDirty;
+	const byte *_lastFrame;
+	bool _offsetClean;
 };
 
 #endif
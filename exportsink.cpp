@@ -0,0 +1,517 @@
+/* smushplay - A simple LucasArts SMUSH video player
+ *
+ * smushplay is the legal property of its developers, whose names can be
+ * found in the AUTHORS file distributed with this source
+ * distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <SDL.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "exportsink.h"
+#include "util.h"
+
+ExportVideoSink::ExportVideoSink(FILE *file, Format format, uint width, uint height, bool highColor, uint rateNumerator, uint rateDenominator, bool constantRate) {
+	_file = file;
+	_format = format;
+	_width = width;
+	_height = height;
+	_highColor = highColor;
+	_rateNumerator = rateNumerator;
+	_rateDenominator = rateDenominator;
+	_constantRate = constantRate;
+
+	_framePitch = width * (highColor ? 2 : 1);
+	_frame = new byte[_framePitch * height];
+	memset(_frame, 0, _framePitch * height);
+	memset(_rgbPalette, 0, sizeof(_rgbPalette));
+
+	_haveFrame = false;
+	_frameTime = _frameDuration = 0;
+	_outputFrames = 0;
+	_error = false;
+
+	_rows.resize(width * 2);
+
+	if (format == kFormatY4M) {
+		// 4:2:0, so each chroma sample covers 2x2 pixels
+		uint chromaSize = ((width + 1) / 2) * ((height + 1) / 2);
+		_output.resize(6 + width * height + chromaSize * 2);
+		memcpy(&_output[0], "FRAME\n", 6);
+
+		if (fprintf(_file, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg\n", width, height, rateNumerator, rateDenominator) < 0)
+			_error = true;
+	} else {
+		_output.resize(width * height * (format == kFormatRGBA ? 4 : 3));
+	}
+}
+
+ExportVideoSink::~ExportVideoSink() {
+	delete[] _frame;
+}
+
+void ExportVideoSink::blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch) {
+	if (width == 0 || height == 0 || x >= _width || y >= _height)
+		return;
+
+	if (x + width > _width)
+		width = _width - x;
+
+	if (y + height > _height)
+		height = _height - y;
+
+	uint bytesPerPixel = _highColor ? 2 : 1;
+	byte *dst = _frame + y * _framePitch + x * bytesPerPixel;
+
+	for (uint i = 0; i < height; i++)
+		memcpy(dst + i * _framePitch, ptr + i * pitch, width * bytesPerPixel);
+}
+
+bool ExportVideoSink::setPalette(const byte *ptr, uint start, uint count) {
+	if (_highColor || !ptr || start + count > 256)
+		return false;
+
+	for (uint i = 0; i < count; i++)
+		_rgbPalette[start + i] = (ptr[i * 3] << 16) | (ptr[i * 3 + 1] << 8) | ptr[i * 3 + 2];
+
+	// The whole frame gets converted every time anyway
+	return false;
+}
+
+void ExportVideoSink::update(uint32 time) {
+	if (_error)
+		return;
+
+	if (!_constantRate) {
+		convertFrame();
+		writeFrame();
+		return;
+	}
+
+	// The last frame lasts until this one, so it can be written out now
+	if (_haveFrame) {
+		writeFramesUntil(time);
+		_frameDuration = time - _frameTime;
+	}
+
+	convertFrame();
+	_frameTime = time;
+	_haveFrame = true;
+}
+
+void ExportVideoSink::finish() {
+	// Guess that the last frame lasts as long as the one before
+	if (_constantRate && _haveFrame)
+		writeFramesUntil(_frameTime + MAX<uint32>(_frameDuration, 1));
+
+	if (fflush(_file) != 0)
+		_error = true;
+}
+
+// Convert a row of 8bpp or native endian RGB565 pixels to 0x00RRGGBB
+static void convertRow(const byte *in, uint width, bool highColor, const uint32 *palette, uint32 *out) {
+	if (highColor) {
+		const uint16 *pixels = (const uint16 *)in;
+
+		// Widen each channel to 8 bits by repeating its top bits at the
+		// bottom
+		for (uint x = 0; x < width; x++) {
+			uint16 pixel = pixels[x];
+			uint32 red = (pixel >> 11) & 0x1F;
+			uint32 green = (pixel >> 5) & 0x3F;
+			uint32 blue = pixel & 0x1F;
+			out[x] = (((red << 3) | (red >> 2)) << 16) | (((green << 2) | (green >> 4)) << 8) | (blue << 3) | (blue >> 2);
+		}
+	} else {
+		for (uint x = 0; x < width; x++)
+			out[x] = palette[in[x]];
+	}
+}
+
+void ExportVideoSink::convertFrame() {
+	if (_format != kFormatY4M) {
+		byte *out = &_output[0];
+		bool alpha = _format == kFormatRGBA;
+
+		for (uint y = 0; y < _height; y++) {
+			convertRow(_frame + y * _framePitch, _width, _highColor, _rgbPalette, &_rows[0]);
+
+			for (uint x = 0; x < _width; x++) {
+				uint32 pixel = _rows[x];
+				*out++ = pixel >> 16;
+				*out++ = pixel >> 8;
+				*out++ = pixel;
+
+				if (alpha)
+					*out++ = 0xFF;
+			}
+		}
+
+		return;
+	}
+
+	// BT.601 with video levels, which is what encoders assume for
+	// YUV4MPEG2. Rows are done in pairs, which share their chroma.
+	uint chromaWidth = (_width + 1) / 2;
+	uint chromaHeight = (_height + 1) / 2;
+	byte *lumaPlane = &_output[6];
+	byte *uPlane = lumaPlane + _width * _height;
+	byte *vPlane = uPlane + chromaWidth * chromaHeight;
+
+	for (uint y = 0; y < _height; y += 2) {
+		uint32 *row0 = &_rows[0];
+		uint32 *row1 = &_rows[_width];
+		uint rowCount = MIN<uint>(_height - y, 2);
+
+		convertRow(_frame + y * _framePitch, _width, _highColor, _rgbPalette, row0);
+
+		if (rowCount == 2)
+			convertRow(_frame + (y + 1) * _framePitch, _width, _highColor, _rgbPalette, row1);
+
+		for (uint i = 0; i < rowCount; i++) {
+			const uint32 *row = i ? row1 : row0;
+			byte *luma = lumaPlane + (y + i) * _width;
+
+			for (uint x = 0; x < _width; x++) {
+				int red = (row[x] >> 16) & 0xFF, green = (row[x] >> 8) & 0xFF, blue = row[x] & 0xFF;
+				luma[x] = ((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16;
+			}
+		}
+
+		byte *u = uPlane + (y / 2) * chromaWidth;
+		byte *v = vPlane + (y / 2) * chromaWidth;
+
+		for (uint x = 0; x < _width; x += 2) {
+			uint columnCount = MIN<uint>(_width - x, 2);
+			int red = 0, green = 0, blue = 0;
+
+			for (uint i = 0; i < rowCount; i++) {
+				const uint32 *row = i ? row1 : row0;
+
+				for (uint j = 0; j < columnCount; j++) {
+					red += (row[x + j] >> 16) & 0xFF;
+					green += (row[x + j] >> 8) & 0xFF;
+					blue += row[x + j] & 0xFF;
+				}
+			}
+
+			int count = rowCount * columnCount;
+			red /= count;
+			green /= count;
+			blue /= count;
+
+			u[x / 2] = ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+			v[x / 2] = ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
+		}
+	}
+}
+
+void ExportVideoSink::writeFrame() {
+	if (fwrite(&_output[0], 1, _output.size(), _file) != _output.size()) {
+		fprintf(stderr, "Failed to write frame %u\n", (uint)_outputFrames);
+		_error = true;
+		return;
+	}
+
+	_outputFrames++;
+}
+
+void ExportVideoSink::writeFramesUntil(uint32 time) {
+	// Output frame n is due at n * 1000 * denominator / numerator ms
+	while (!_error && _outputFrames * 1000 * _rateDenominator < (uint64)time * _rateNumerator)
+		writeFrame();
+}
+
+PNGVideoSink::PNGVideoSink(const char *prefix, uint width, uint height, bool highColor, bool indexed, uint threadCount) : _prefix(prefix) {
+	_width = width;
+	_height = height;
+	_highColor = highColor;
+	_indexed = indexed && !highColor;
+
+	_framePitch = width * (highColor ? 2 : 1);
+	_frame = new byte[_framePitch * height];
+	memset(_frame, 0, _framePitch * height);
+	memset(_colors, 0, sizeof(_colors));
+	_frameCount = 0;
+
+	_nextJob = 0;
+	_writing = _finished = _error = false;
+	_mutex = SDL_CreateMutex();
+	_jobReady = SDL_CreateCond();
+	_jobDone = SDL_CreateCond();
+
+	for (uint i = 0; i < threadCount; i++) {
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+		SDL_Thread *thread = SDL_CreateThread(workerThread, "png", this);
+#else
+		SDL_Thread *thread = SDL_CreateThread(workerThread, this);
+#endif
+
+		if (thread)
+			_threads.push_back(thread);
+	}
+}
+
+PNGVideoSink::~PNGVideoSink() {
+	if (!_finished)
+		finish();
+
+	delete[] _frame;
+	SDL_DestroyCond(_jobDone);
+	SDL_DestroyCond(_jobReady);
+	SDL_DestroyMutex(_mutex);
+}
+
+void PNGVideoSink::blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch) {
+	if (width == 0 || height == 0 || x >= _width || y >= _height)
+		return;
+
+	if (x + width > _width)
+		width = _width - x;
+
+	if (y + height > _height)
+		height = _height - y;
+
+	uint bytesPerPixel = _highColor ? 2 : 1;
+	byte *dst = _frame + y * _framePitch + x * bytesPerPixel;
+
+	for (uint i = 0; i < height; i++)
+		memcpy(dst + i * _framePitch, ptr + i * pitch, width * bytesPerPixel);
+}
+
+bool PNGVideoSink::setPalette(const byte *ptr, uint start, uint count) {
+	if (_highColor || !ptr || start + count > 256)
+		return false;
+
+	memcpy(_colors + start * 3, ptr, count * 3);
+
+	// Every frame gets written whole anyway
+	return false;
+}
+
+void PNGVideoSink::update(uint32) {
+	Job *job = new Job();
+	job->frameNumber = _frameCount++;
+	job->pixels = new byte[_framePitch * _height];
+	memcpy(job->pixels, _frame, _framePitch * _height);
+	memcpy(job->colors, _colors, sizeof(_colors));
+	job->compressed = false;
+
+	// Without any workers, there's nothing left but to do it here
+	if (_threads.empty()) {
+		compressJob(*job);
+
+		if (!writeJob(*job))
+			_error = true;
+
+		delete[] job->pixels;
+		delete job;
+		return;
+	}
+
+	// Only wait if the workers are far behind, so the frames waiting don't
+	// pile up
+	SDL_mutexP(_mutex);
+
+	while (_jobs.size() >= _threads.size() * kMaxJobsPerThread && !_error)
+		SDL_CondWait(_jobDone, _mutex);
+
+	_jobs.push_back(job);
+	SDL_CondSignal(_jobReady);
+	SDL_mutexV(_mutex);
+}
+
+void PNGVideoSink::finish() {
+	SDL_mutexP(_mutex);
+	_finished = true;
+	SDL_CondBroadcast(_jobReady);
+	SDL_mutexV(_mutex);
+
+	// The workers only quit once every job is written
+	for (uint i = 0; i < _threads.size(); i++)
+		SDL_WaitThread(_threads[i], 0);
+
+	_threads.clear();
+}
+
+bool PNGVideoSink::isStopped() {
+	SDL_mutexP(_mutex);
+	bool error = _error;
+	SDL_mutexV(_mutex);
+	return error;
+}
+
+int PNGVideoSink::workerThread(void *data) {
+	((PNGVideoSink *)data)->runWorker();
+	return 0;
+}
+
+void PNGVideoSink::runWorker() {
+	SDL_mutexP(_mutex);
+
+	for (;;) {
+		while (_nextJob == _jobs.size() && !_finished)
+			SDL_CondWait(_jobReady, _mutex);
+
+		if (_nextJob == _jobs.size())
+			break;
+
+		Job *job = _jobs[_nextJob++];
+		SDL_mutexV(_mutex);
+
+		compressJob(*job);
+
+		SDL_mutexP(_mutex);
+		job->compressed = true;
+
+		// Write out the oldest frames that are done, unless another worker
+		// is already at it. It checks again after each file, so it catches
+		// this one too.
+		if (_writing)
+			continue;
+
+		_writing = true;
+
+		while (!_jobs.empty() && _jobs.front()->compressed) {
+			Job *done = _jobs.front();
+			_jobs.pop_front();
+			_nextJob--;
+			SDL_mutexV(_mutex);
+
+			bool written = writeJob(*done);
+			delete[] done->pixels;
+			delete done;
+
+			SDL_mutexP(_mutex);
+
+			if (!written)
+				_error = true;
+
+			SDL_CondSignal(_jobDone);
+		}
+
+		_writing = false;
+	}
+
+	SDL_mutexV(_mutex);
+}
+
+static void appendUint32BE(std::vector<byte> &data, uint32 value) {
+	data.push_back(value >> 24);
+	data.push_back(value >> 16);
+	data.push_back(value >> 8);
+	data.push_back(value);
+}
+
+static void appendChunk(std::vector<byte> &png, const char *type, const byte *data, uint32 size) {
+	appendUint32BE(png, size);
+	uint32 start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data, data + size);
+	appendUint32BE(png, crc32(0, &png[start], size + 4));
+}
+
+void PNGVideoSink::compressJob(Job &job) const {
+	// Each row starts with its filter type. Indexed rows are stored as they
+	// are, and RGB rows as the difference to the pixel on the left, which
+	// compresses better.
+	uint rowSize = _width * (_indexed ? 1 : 3) + 1;
+	std::vector<byte> rows(rowSize * _height);
+	std::vector<uint32> rgb(_width);
+	uint32 palette[256];
+
+	for (uint i = 0; i < 256; i++)
+		palette[i] = (job.colors[i * 3] << 16) | (job.colors[i * 3 + 1] << 8) | job.colors[i * 3 + 2];
+
+	for (uint y = 0; y < _height; y++) {
+		const byte *in = job.pixels + y * _framePitch;
+		byte *out = &rows[y * rowSize];
+
+		if (_indexed) {
+			*out++ = 0;
+			memcpy(out, in, _width);
+			continue;
+		}
+
+		*out++ = 1;
+		convertRow(in, _width, _highColor, palette, &rgb[0]);
+		uint32 last = 0;
+
+		for (uint x = 0; x < _width; x++) {
+			uint32 pixel = rgb[x];
+			*out++ = (pixel >> 16) - (last >> 16);
+			*out++ = (pixel >> 8) - (last >> 8);
+			*out++ = pixel - last;
+			last = pixel;
+		}
+	}
+
+	uLongf compressedSize = compressBound(rows.size());
+	std::vector<byte> compressed(compressedSize);
+
+	if (compress2(&compressed[0], &compressedSize, &rows[0], rows.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+		return;
+
+	static const byte signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	job.png.assign(signature, signature + sizeof(signature));
+
+	std::vector<byte> header;
+	appendUint32BE(header, _width);
+	appendUint32BE(header, _height);
+	header.push_back(8);               // bit depth
+	header.push_back(_indexed ? 3 : 2); // color type
+	header.push_back(0);               // compression
+	header.push_back(0);               // filter
+	header.push_back(0);               // interlace
+	appendChunk(job.png, "IHDR", &header[0], header.size());
+
+	if (_indexed)
+		appendChunk(job.png, "PLTE", job.colors, sizeof(job.colors));
+
+	appendChunk(job.png, "IDAT", &compressed[0], compressedSize);
+	appendChunk(job.png, "IEND", 0, 0);
+}
+
+bool PNGVideoSink::writeJob(const Job &job) const {
+	char number[16];
+	sprintf(number, "%05u.png", job.frameNumber);
+	std::string fileName = _prefix + number;
+
+	if (job.png.empty()) {
+		fprintf(stderr, "Failed to compress '%s'\n", fileName.c_str());
+		return false;
+	}
+
+	FILE *file = fopen(fileName.c_str(), "wb");
+
+	if (!file) {
+		fprintf(stderr, "Failed to open '%s' for writing\n", fileName.c_str());
+		return false;
+	}
+
+	bool written = fwrite(&job.png[0], 1, job.png.size(), file) == job.png.size();
+
+	if (fclose(file) != 0)
+		written = false;
+
+	if (!written)
+		fprintf(stderr, "Failed to write '%s'\n", fileName.c_str());
+
+	return written;
+}
@@ -0,0 +1,172 @@
+/* smushplay - A simple LucasArts SMUSH video player
+ *
+ * smushplay is the legal property of its developers, whose names can be
+ * found in the AUTHORS file distributed with this source
+ * distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef EXPORTSINK_H
+#define EXPORTSINK_H
+
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "types.h"
+#include "videosink.h"
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+/**
+ * A sink that writes every frame to a file as raw RGB24, raw RGBA, or
+ * YUV4MPEG2, for piping into an encoder. Each frame is converted into one
+ * buffer and written in one go.
+ */
+class ExportVideoSink : public VideoSink {
+public:
+	enum Format {
+		kFormatRGB24,
+		kFormatRGBA,
+		kFormatY4M
+	};
+
+	/**
+	 * Write frames of a width x height video to file, which is left open.
+	 * The frame rate is rateNumerator / rateDenominator frames per second.
+	 * If constantRate is set, frames are repeated or dropped to match that
+	 * rate exactly. Otherwise, each frame is written once and the rate is
+	 * only used for the YUV4MPEG2 header.
+	 */
+	ExportVideoSink(FILE *file, Format format, uint width, uint height, bool highColor, uint rateNumerator, uint rateDenominator, bool constantRate);
+	~ExportVideoSink();
+
+	void blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch);
+	bool setPalette(const byte *ptr, uint start, uint count);
+	void update(uint32 time);
+	void finish();
+
+	/**
+	 * @return true once writing failed
+	 */
+	bool isStopped() { return _error; }
+
+private:
+	FILE *_file;
+	Format _format;
+	uint _width, _height;
+	bool _highColor;
+	uint _rateNumerator, _rateDenominator;
+	bool _constantRate;
+
+	// The whole frame as given, since only the parts that changed get
+	// blitted
+	byte *_frame;
+	uint _framePitch;
+	uint32 _rgbPalette[256];
+
+	// The frame in the output format, and what it's converted through
+	std::vector<byte> _output;
+	std::vector<uint32> _rows;
+
+	// The last frame converted and when it was due, which is only known to
+	// end once the next one comes along
+	bool _haveFrame;
+	uint32 _frameTime, _frameDuration;
+	uint64 _outputFrames;
+	bool _error;
+
+	void convertFrame();
+	void writeFrame();
+	void writeFramesUntil(uint32 time);
+};
+
+/**
+ * A sink that writes each frame to its own PNG file, named by the frame
+ * number after a prefix. Frames are compressed by a pool of worker threads,
+ * so decoding only waits when they fall far behind, and the files are
+ * still written in frame order.
+ */
+class PNGVideoSink : public VideoSink {
+public:
+	/**
+	 * Write frames of a width x height video to <prefix><frame>.png with
+	 * threadCount workers. 8bpp videos can be written as indexed PNGs,
+	 * which keep their palette.
+	 */
+	PNGVideoSink(const char *prefix, uint width, uint height, bool highColor, bool indexed, uint threadCount);
+	~PNGVideoSink();
+
+	void blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch);
+	bool setPalette(const byte *ptr, uint start, uint count);
+	void update(uint32 time);
+
+	/**
+	 * Wait for all of the frames to be written.
+	 */
+	void finish();
+
+	/**
+	 * @return true once writing failed
+	 */
+	bool isStopped();
+
+private:
+	std::string _prefix;
+	uint _width, _height;
+	bool _highColor, _indexed;
+
+	// The whole frame as given, since only the parts that changed get
+	// blitted
+	byte *_frame;
+	uint _framePitch;
+	byte _colors[256 * 3];
+	uint _frameCount;
+
+	// A frame to be written, with its own copy of the pixels and palette
+	struct Job {
+		uint frameNumber;
+		byte *pixels;
+		byte colors[256 * 3];
+		std::vector<byte> png;
+		bool compressed;
+	};
+
+	enum {
+		kMaxJobsPerThread = 4
+	};
+
+	// Jobs in frame order, from the oldest one not written yet. Workers
+	// take them starting at _nextJob. Whichever worker finds the oldest
+	// one compressed writes it and any after it that are done too. All of
+	// this is guarded by _mutex.
+	std::deque<Job *> _jobs;
+	uint _nextJob;
+	bool _writing, _finished, _error;
+	SDL_mutex *_mutex;
+	SDL_cond *_jobReady, *_jobDone;
+	std::vector<SDL_Thread *> _threads;
+
+	static int workerThread(void *data);
+	void runWorker();
+	void compressJob(Job &job) const;
+	bool writeJob(const Job &job) const;
+};
+
+#endif
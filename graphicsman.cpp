@@ -24,77 +24,660 @@
 #include <stdio.h>
 
 #include "graphicsman.h"
-
-// TODO: aspect ratio correction option
-// TODO: resize/scaling option
+#include "util.h"
 
 GraphicsManager::GraphicsManager() {
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	_window = 0;
+	_renderer = 0;
+	_texture = 0;
+#else
 	_mainScreen = 0;
-	_workingScreen = 0;
+#endif
+	_format = 0;
+	_width = _height = 0;
+	_highColor = false;
+	_screenWidth = _screenHeight = 0;
+	_scaleMode = kScaleRepeat;
+	_scale = 1;
+	memset(_rgbPalette, 0, sizeof(_rgbPalette));
+	memset(_colors, 0, sizeof(_colors));
+	_newPalette = false;
+	memset(_screenColors, 0, sizeof(_screenColors));
+	memset(_palette, 0, sizeof(_palette));
+
+	for (uint i = 0; i < kFrameCount; i++) {
+		_frames[i].pixels = 0;
+		_frames[i].newPalette = false;
+	}
+
+	_framePitch = 0;
+	_fillFrame = _showFrame = _queuedFrames = 0;
+	_filling = _finished = _stopped = false;
+	_mutex = SDL_CreateMutex();
+	_frameReady = SDL_CreateCond();
+	_frameFree = SDL_CreateCond();
 }
 
 GraphicsManager::~GraphicsManager() {
-	if (_workingScreen)
-		SDL_FreeSurface(_workingScreen);
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	if (_format)
+		SDL_FreeFormat(_format);
+
+	if (_texture)
+		SDL_DestroyTexture(_texture);
+
+	if (_renderer)
+		SDL_DestroyRenderer(_renderer);
+
+	if (_window)
+		SDL_DestroyWindow(_window);
+#endif
+
+	for (uint i = 0; i < kFrameCount; i++)
+		delete[] _frames[i].pixels;
+
+	SDL_DestroyCond(_frameFree);
+	SDL_DestroyCond(_frameReady);
+	SDL_DestroyMutex(_mutex);
+}
+
+static void makeScaleSteps(std::vector<ScaleStep> &steps, uint size, uint screenSize) {
+	steps.resize(screenSize);
+
+	for (uint i = 0; i < screenSize; i++) {
+		// Sample at the middle of the screen pixel, in 1/256ths of a frame
+		// pixel
+		int pos = (int)((2 * i + 1) * size * 128 / screenSize) - 128;
+		pos = MAX(pos, 0);
+
+		steps[i].index0 = MIN<uint>(pos >> 8, size - 1);
+		steps[i].index1 = MIN(steps[i].index0 + 1, size - 1);
+		steps[i].weight = pos & 0xFF;
+	}
 }
 
-bool GraphicsManager::init(uint width, uint height, bool isHighColor) {
+bool GraphicsManager::init(uint width, uint height, bool isHighColor, uint screenWidth, uint screenHeight) {
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	_window = SDL_CreateWindow("smushplay", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screenWidth, screenHeight, 0);
+
+	if (!_window)
+		return false;
+
+	// Prefer a renderer that waits for the display, but fall back on the
+	// software one. SDL_RENDER_DRIVER can pick a specific one.
+	_renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+	if (!_renderer)
+		_renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_SOFTWARE);
+
+	if (!_renderer)
+		return false;
+
+	// Try 32bpp first
+	uint32 format = SDL_PIXELFORMAT_RGB888;
+	_texture = SDL_CreateTexture(_renderer, format, SDL_TEXTUREACCESS_STREAMING, screenWidth, screenHeight);
+
+	// Fall back on 16bpp
+	if (!_texture) {
+		format = SDL_PIXELFORMAT_RGB565;
+		_texture = SDL_CreateTexture(_renderer, format, SDL_TEXTUREACCESS_STREAMING, screenWidth, screenHeight);
+	}
+
+	if (!_texture)
+		return false;
+
+	_format = SDL_AllocFormat(format);
+
+	if (!_format)
+		return false;
+#else
 	// Try 32bpp first
-	_mainScreen = SDL_SetVideoMode(width, height, 32, SDL_SWSURFACE);
+	_mainScreen = SDL_SetVideoMode(screenWidth, screenHeight, 32, SDL_SWSURFACE);
 
 	// Fall back on 16bpp
 	if (!_mainScreen)
-		_mainScreen = SDL_SetVideoMode(width, height, 16, SDL_SWSURFACE);
+		_mainScreen = SDL_SetVideoMode(screenWidth, screenHeight, 16, SDL_SWSURFACE);
 
 	if (!_mainScreen)
 		return false;
 
-	if (isHighColor)
-		_workingScreen = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 16, 0xF800, 0x7E0, 0x1F, 0);
-	else
-		_workingScreen = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height, 8, 0, 0, 0, 0);
+	_format = _mainScreen->format;
+
+	// Add our fun title
+	SDL_WM_SetCaption("smushplay", "smushplay");
+#endif
+
+	_width = width;
+	_height = height;
+	_screenWidth = screenWidth;
+	_screenHeight = screenHeight;
+
+	if (screenWidth % width == 0 && screenHeight == height * (screenWidth / width)) {
+		_scaleMode = kScaleRepeat;
+		_scale = screenWidth / width;
+		_rowBuffer.resize(width);
+	} else if (screenWidth % width == 0) {
+		_scaleMode = kScaleStretch;
+		_scale = screenWidth / width;
+		makeScaleSteps(_ySteps, height, screenHeight);
+		_rgbFrame.resize(width * height);
+	} else {
+		_scaleMode = kScaleFilter;
+		_scale = 0;
+		makeScaleSteps(_xSteps, width, screenWidth);
+		makeScaleSteps(_ySteps, height, screenHeight);
+		_rgbFrame.resize(width * height);
+	}
+
+	// The palette starts out all black
+	for (uint i = 0; i < 256; i++)
+		_palette[i] = SDL_MapRGB(_format, 0, 0, 0);
+
+	_highColor = isHighColor;
+	_framePitch = width * (_highColor ? 2 : 1);
+
+	for (uint i = 0; i < kFrameCount; i++)
+		_frames[i].pixels = new byte[_framePitch * height];
+
+	// Each channel is widened to 8 bits by repeating its top bits at the
+	// bottom. Red and the top half of green only come from the high byte,
+	// and the rest of green and blue only from the low byte, so the two
+	// halves can be converted on their own.
+	for (uint i = 0; i < 256; i++) {
+		byte red = (i & 0xF8) | (i >> 5);
+		byte greenHigh = ((i & 7) << 5) | ((i & 6) >> 1);
+		byte greenLow = (i >> 5) << 2;
+		byte blue = ((i & 0x1F) << 3) | ((i & 0x1F) >> 2);
+
+		_highColorTables[0][i] = SDL_MapRGB(_format, red, greenHigh, 0);
+		_highColorTables[1][i] = SDL_MapRGB(_format, 0, greenLow, blue);
+		_rgbHighColorTables[0][i] = (red << 16) | (greenHigh << 8);
+		_rgbHighColorTables[1][i] = (greenLow << 8) | blue;
+	}
 
 	return true;
 }
 
-void GraphicsManager::setPalette(const byte *ptr, uint start, uint count) {
-	if (_workingScreen->format->BitsPerPixel != 8 || count == 0 || !ptr || start + count > 256)
-		return;
+bool GraphicsManager::setPalette(const byte *ptr, uint start, uint count) {
+	if (_highColor || count == 0 || !ptr || start + count > 256)
+		return false;
+
+	if (memcmp(_colors + start * 3, ptr, count * 3) == 0)
+		return false;
+
+	memcpy(_colors + start * 3, ptr, count * 3);
+	_newPalette = true;
+	return true;
+}
+
+// Convert rows of 8bpp pixels to the screen's format through the palette.
+// Four pixels are looked up at a time, which keeps the independent loads
+// and stores of each group free to overlap.
+template<typename PixelType>
+static void convertIndexed(byte *dst, uint dstPitch, const byte *src, uint srcPitch, uint width, uint height, const uint32 *palette) {
+	for (uint y = 0; y < height; y++) {
+		PixelType *out = (PixelType *)(dst + y * dstPitch);
+		const byte *in = src + y * srcPitch;
+		uint x = 0;
+
+		for (; x + 4 <= width; x += 4) {
+			PixelType p0 = palette[in[x]];
+			PixelType p1 = palette[in[x + 1]];
+			PixelType p2 = palette[in[x + 2]];
+			PixelType p3 = palette[in[x + 3]];
+			out[x] = p0;
+			out[x + 1] = p1;
+			out[x + 2] = p2;
+			out[x + 3] = p3;
+		}
+
+		for (; x < width; x++)
+			out[x] = palette[in[x]];
+	}
+}
+
+// Convert rows of native endian RGB565 pixels to the screen's format
+template<typename PixelType>
+static void convertHighColor(byte *dst, uint dstPitch, const byte *src, uint srcPitch, uint width, uint height, const uint32 (*tables)[256]) {
+	for (uint y = 0; y < height; y++) {
+		PixelType *out = (PixelType *)(dst + y * dstPitch);
+		const uint16 *in = (const uint16 *)(src + y * srcPitch);
+		uint x = 0;
+
+		for (; x + 2 <= width; x += 2) {
+			uint16 pixel0 = in[x];
+			uint16 pixel1 = in[x + 1];
+			out[x] = tables[0][pixel0 >> 8] | tables[1][pixel0 & 0xFF];
+			out[x + 1] = tables[0][pixel1 >> 8] | tables[1][pixel1 & 0xFF];
+		}
+
+		if (x < width)
+			out[x] = tables[0][in[x] >> 8] | tables[1][in[x] & 0xFF];
+	}
+}
+
+// Repeat each pixel of a row scale times across, and the row scale times
+// down
+template<typename PixelType>
+static void expandRow(byte *dst, uint dstPitch, const PixelType *in, uint width, uint scale) {
+	PixelType *out = (PixelType *)dst;
+
+	switch (scale) {
+	case 2:
+		for (uint x = 0; x < width; x++, out += 2)
+			out[0] = out[1] = in[x];
+		break;
+	case 3:
+		for (uint x = 0; x < width; x++, out += 3)
+			out[0] = out[1] = out[2] = in[x];
+		break;
+	case 4:
+		for (uint x = 0; x < width; x++, out += 4)
+			out[0] = out[1] = out[2] = out[3] = in[x];
+		break;
+	default:
+		for (uint x = 0; x < width; x++)
+			for (uint i = 0; i < scale; i++)
+				*out++ = in[x];
+	}
+
+	for (uint i = 1; i < scale; i++)
+		memcpy(dst + i * dstPitch, dst, width * scale * sizeof(PixelType));
+}
+
+// Blend two 0x00RRGGBB pixels, with weight/256 of the second one. Red and
+// blue get blended together, with room in between for the carry.
+static inline uint32 blendPixels(uint32 pixel0, uint32 pixel1, uint weight) {
+	uint32 redBlue = ((pixel0 & 0xFF00FF) * (256 - weight) + (pixel1 & 0xFF00FF) * weight) >> 8;
+	uint32 green = ((pixel0 & 0xFF00) * (256 - weight) + (pixel1 & 0xFF00) * weight) >> 8;
+	return (redBlue & 0xFF00FF) | (green & 0xFF00);
+}
+
+// Converts 0x00RRGGBB pixels to the screen's format
+struct PixelPacker {
+	PixelPacker(const SDL_PixelFormat *format) :
+		rLoss(format->Rloss), gLoss(format->Gloss), bLoss(format->Bloss),
+		rShift(format->Rshift), gShift(format->Gshift), bShift(format->Bshift),
+		alpha(format->Amask) {}
 
-	SDL_Color *colors = new SDL_Color[count];
+	uint32 operator()(uint32 pixel) const {
+		return ((((pixel >> 16) & 0xFF) >> rLoss) << rShift) |
+				((((pixel >> 8) & 0xFF) >> gLoss) << gShift) |
+				(((pixel & 0xFF) >> bLoss) << bShift) | alpha;
+	}
+
+	uint rLoss, gLoss, bLoss;
+	uint rShift, gShift, bShift;
+	uint32 alpha;
+};
+
+// Blend rows of 0x00RRGGBB pixels down through ySteps, which start at the
+// first screen row written, and convert them to the screen's format with
+// each pixel repeated scale times across
+template<typename PixelType>
+static void stretchRows(byte *dst, uint dstPitch, const uint32 *src, uint srcPitch, const ScaleStep *ySteps, uint width, uint height, uint scale, const SDL_PixelFormat *format) {
+	PixelPacker pack(format);
 
-	for (uint i = 0; i < count; i++) {
-		colors[i].r = ptr[i * 3];
-		colors[i].g = ptr[i * 3 + 1];
-		colors[i].b = ptr[i * 3 + 2];
+	for (uint y = 0; y < height; y++) {
+		PixelType *out = (PixelType *)(dst + y * dstPitch);
+		const uint32 *in0 = src + ySteps[y].index0 * srcPitch;
+		const uint32 *in1 = src + ySteps[y].index1 * srcPitch;
+		uint weight = ySteps[y].weight;
+
+		for (uint x = 0; x < width; x++) {
+			PixelType pixel = pack(weight ? blendPixels(in0[x], in1[x], weight) : in0[x]);
+
+			for (uint i = 0; i < scale; i++)
+				*out++ = pixel;
+		}
 	}
+}
+
+// Scale 0x00RRGGBB pixels with bilinear filtering and convert them to the
+// screen's format. xSteps and ySteps start at the first screen pixel
+// written.
+template<typename PixelType>
+static void scaleBilinear(byte *dst, uint dstPitch, const uint32 *src, uint srcPitch, const ScaleStep *xSteps, const ScaleStep *ySteps, uint width, uint height, const SDL_PixelFormat *format) {
+	PixelPacker pack(format);
+
+	for (uint y = 0; y < height; y++) {
+		PixelType *out = (PixelType *)(dst + y * dstPitch);
+		const uint32 *in0 = src + ySteps[y].index0 * srcPitch;
+		const uint32 *in1 = src + ySteps[y].index1 * srcPitch;
+		uint yWeight = ySteps[y].weight;
+
+		for (uint x = 0; x < width; x++) {
+			const ScaleStep &step = xSteps[x];
+			uint32 top = blendPixels(in0[step.index0], in0[step.index1], step.weight);
+			uint32 bottom = blendPixels(in1[step.index0], in1[step.index1], step.weight);
+			out[x] = pack(blendPixels(top, bottom, yWeight));
+		}
+	}
+}
 
-	SDL_SetColors(_workingScreen, colors, start, count);
-	delete[] colors;
+GraphicsManager::Frame *GraphicsManager::getFillFrame() {
+	Frame &frame = _frames[_fillFrame];
+
+	if (_filling)
+		return &frame;
+
+	// Wait until present() is done with the frame
+	SDL_mutexP(_mutex);
+
+	while (_queuedFrames == kFrameCount && !_stopped)
+		SDL_CondWait(_frameFree, _mutex);
+
+	bool stopped = _stopped;
+	SDL_mutexV(_mutex);
+
+	if (stopped)
+		return 0;
+
+	frame.dirtyRects.clear();
+	frame.newPalette = false;
+	_filling = true;
+	return &frame;
 }
 
 void GraphicsManager::blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch) {
-	if (width == 0 || height == 0)
+	if (width == 0 || height == 0 || x >= _width || y >= _height)
 		return;
 
-	if (x + width > (uint)_workingScreen->w)
-		width = _workingScreen->w - x;
+	if (x + width > _width)
+		width = _width - x;
 
-	if (y + height > (uint)_workingScreen->h)
-		height = _workingScreen->h - y;
+	if (y + height > _height)
+		height = _height - y;
 
-	SDL_LockSurface(_workingScreen);
+	Frame *frame = getFillFrame();
+
+	if (!frame)
+		return;
+
+	// The pixels are only converted when the frame gets shown, so just
+	// copy them for now
+	uint bytesPerPixel = _highColor ? 2 : 1;
+	byte *dst = frame->pixels + y * _framePitch + x * bytesPerPixel;
 
 	for (uint i = 0; i < height; i++)
-		memcpy((byte *)_workingScreen->pixels + (i + y) * _workingScreen->pitch + x, ptr + i * pitch, width * _workingScreen->format->BytesPerPixel);
+		memcpy(dst + i * _framePitch, ptr + i * pitch, width * bytesPerPixel);
+
+	addDirtyRect(*frame, Rect(x, y, x + width, y + height));
+}
 
-	SDL_UnlockSurface(_workingScreen);
+void GraphicsManager::addDirtyRect(Frame &frame, const Rect &rect) {
+	std::vector<Rect> &dirtyRects = frame.dirtyRects;
+
+	// Once the whole screen is dirty, there's nothing left to add
+	if (dirtyRects.size() == 1 && dirtyRects[0].left == 0 && dirtyRects[0].top == 0 &&
+			dirtyRects[0].right == (int)_width && dirtyRects[0].bottom == (int)_height)
+		return;
+
+	if (rect.left == 0 && rect.top == 0 && rect.right == (int)_width && rect.bottom == (int)_height)
+		dirtyRects.clear();
+
+	dirtyRects.push_back(rect);
+}
+
+void GraphicsManager::update(uint32) {
+	if (!_filling && !_newPalette)
+		return;
+
+	Frame *frame = getFillFrame();
+
+	if (!frame)
+		return;
+
+	if (_newPalette) {
+		memcpy(frame->colors, _colors, sizeof(_colors));
+		frame->newPalette = true;
+		_newPalette = false;
+	}
+
+	SDL_mutexP(_mutex);
+	_fillFrame = (_fillFrame + 1) % kFrameCount;
+	_queuedFrames++;
+	SDL_CondSignal(_frameReady);
+	SDL_mutexV(_mutex);
+
+	_filling = false;
+}
+
+void GraphicsManager::finish() {
+	SDL_mutexP(_mutex);
+	_finished = true;
+	SDL_CondSignal(_frameReady);
+	SDL_mutexV(_mutex);
+}
+
+bool GraphicsManager::isStopped() {
+	SDL_mutexP(_mutex);
+	bool stopped = _stopped;
+	SDL_mutexV(_mutex);
+	return stopped;
+}
+
+bool GraphicsManager::present(uint32 timeout) {
+	SDL_mutexP(_mutex);
+
+	if (_queuedFrames == 0 && !_finished && !_stopped)
+		SDL_CondWaitTimeout(_frameReady, _mutex, timeout);
+
+	if (_queuedFrames == 0 || _stopped) {
+		bool more = !_finished && !_stopped;
+		SDL_mutexV(_mutex);
+		return more;
+	}
+
+	Frame &frame = _frames[_showFrame];
+	SDL_mutexV(_mutex);
+
+	// The decoder leaves queued frames alone, so this can go on without
+	// holding it up
+	showFrame(frame);
+
+	SDL_mutexP(_mutex);
+	_showFrame = (_showFrame + 1) % kFrameCount;
+	_queuedFrames--;
+	SDL_CondSignal(_frameFree);
+	SDL_mutexV(_mutex);
+
+	return true;
+}
+
+void GraphicsManager::stop() {
+	SDL_mutexP(_mutex);
+	_stopped = true;
+	SDL_CondSignal(_frameFree);
+	SDL_mutexV(_mutex);
+}
+
+void GraphicsManager::showFrame(Frame &frame) {
+	// Only convert the colors that changed, which is usually few of them
+	if (frame.newPalette) {
+		for (uint i = 0; i < 256; i++) {
+			byte *color = _screenColors + i * 3;
+
+			if (memcmp(color, frame.colors + i * 3, 3) != 0) {
+				memcpy(color, frame.colors + i * 3, 3);
+				_palette[i] = SDL_MapRGB(_format, color[0], color[1], color[2]);
+				_rgbPalette[i] = (color[0] << 16) | (color[1] << 8) | color[2];
+			}
+		}
+	}
+
+	if (frame.dirtyRects.empty())
+		return;
+
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	// Only the dirty areas get locked, so the rest of the texture keeps the
+	// frames before
+	for (uint i = 0; i < frame.dirtyRects.size(); i++) {
+		const Rect &dirty = frame.dirtyRects[i];
+		Rect screenRect = getScreenRect(dirty);
+
+		// Shrunk down, an area might not reach any screen pixels. It still
+		// has to be converted for filtering the ones around it later.
+		if (screenRect.isEmpty()) {
+			convertRect(frame, dirty, screenRect, 0, 0);
+			continue;
+		}
+
+		SDL_Rect rect;
+		rect.x = screenRect.left;
+		rect.y = screenRect.top;
+		rect.w = screenRect.right - screenRect.left;
+		rect.h = screenRect.bottom - screenRect.top;
+
+		void *pixels;
+		int pitch;
+		if (SDL_LockTexture(_texture, &rect, &pixels, &pitch) < 0)
+			continue;
+
+		convertRect(frame, dirty, screenRect, (byte *)pixels, pitch);
+		SDL_UnlockTexture(_texture);
+	}
+
+	SDL_RenderCopy(_renderer, _texture, 0, 0);
+	SDL_RenderPresent(_renderer);
+#else
+	std::vector<SDL_Rect> rects(frame.dirtyRects.size());
+
+	SDL_LockSurface(_mainScreen);
+
+	for (uint i = 0; i < frame.dirtyRects.size(); i++) {
+		const Rect &dirty = frame.dirtyRects[i];
+		Rect screenRect = getScreenRect(dirty);
+		byte *dst = (byte *)_mainScreen->pixels + screenRect.top * _mainScreen->pitch + screenRect.left * _format->BytesPerPixel;
+		convertRect(frame, dirty, screenRect, dst, _mainScreen->pitch);
+
+		rects[i].x = screenRect.left;
+		rects[i].y = screenRect.top;
+		rects[i].w = screenRect.right - screenRect.left;
+		rects[i].h = screenRect.bottom - screenRect.top;
+	}
+
+	SDL_UnlockSurface(_mainScreen);
+
+	SDL_UpdateRects(_mainScreen, rects.size(), &rects[0]);
+#endif
+}
+
+// Find the screen pixels between the first one sampling from frame pixel
+// start or after, and the first one only sampling from frame pixel end or
+// after
+static void findScreenSpan(const std::vector<ScaleStep> &steps, int start, int end, int &screenStart, int &screenEnd) {
+	uint low = 0, high = steps.size();
+
+	while (low < high) {
+		uint middle = (low + high) / 2;
+
+		if ((int)steps[middle].index1 < start)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	screenStart = low;
+	high = steps.size();
+
+	while (low < high) {
+		uint middle = (low + high) / 2;
+
+		if ((int)steps[middle].index0 < end)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	screenEnd = low;
 }
 
-void GraphicsManager::update() {
-	// Blit the 8bpp surface to the main screen
-	SDL_BlitSurface(_workingScreen, 0, _mainScreen, 0);
+Rect GraphicsManager::getScreenRect(const Rect &rect) const {
+	if (_scaleMode == kScaleRepeat)
+		return Rect(rect.left * _scale, rect.top * _scale, rect.right * _scale, rect.bottom * _scale);
+
+	// Blended screen pixels also pick up the frame pixels around them
+	Rect screenRect;
+
+	if (_scaleMode == kScaleStretch) {
+		screenRect.left = rect.left * _scale;
+		screenRect.right = rect.right * _scale;
+	} else {
+		findScreenSpan(_xSteps, rect.left, rect.right, screenRect.left, screenRect.right);
+	}
+
+	findScreenSpan(_ySteps, rect.top, rect.bottom, screenRect.top, screenRect.bottom);
+	return screenRect;
+}
+
+void GraphicsManager::convertRect(const Frame &frame, const Rect &rect, const Rect &screenRect, byte *dst, uint dstPitch) {
+	uint width = rect.right - rect.left;
+	uint height = rect.bottom - rect.top;
+	const byte *src = frame.pixels + rect.top * _framePitch + rect.left * (_highColor ? 2 : 1);
+
+	if (_scaleMode == kScaleRepeat && _scale == 1) {
+		convertPixels(dst, dstPitch, src, width, height);
+		return;
+	}
+
+	if (_scaleMode == kScaleRepeat) {
+		// Convert a row at a time, which stays in the cache while it gets
+		// spread over the screen
+		for (uint y = 0; y < height; y++) {
+			convertPixels((byte *)&_rowBuffer[0], 0, src + y * _framePitch, width, 1);
+
+			if (_format->BytesPerPixel == 4)
+				expandRow<uint32>(dst + y * _scale * dstPitch, dstPitch, (const uint32 *)&_rowBuffer[0], width, _scale);
+			else
+				expandRow<uint16>(dst + y * _scale * dstPitch, dstPitch, (const uint16 *)&_rowBuffer[0], width, _scale);
+		}
+
+		return;
+	}
+
+	uint32 *rgb = &_rgbFrame[rect.top * _width + rect.left];
+
+	if (_highColor)
+		convertHighColor<uint32>((byte *)rgb, _width * 4, src, _framePitch, width, height, _rgbHighColorTables);
+	else
+		convertIndexed<uint32>((byte *)rgb, _width * 4, src, _framePitch, width, height, _rgbPalette);
+
+	if (screenRect.isEmpty())
+		return;
+
+	uint screenWidth = screenRect.right - screenRect.left;
+	uint screenHeight = screenRect.bottom - screenRect.top;
+	const ScaleStep *ySteps = &_ySteps[screenRect.top];
+
+	if (_scaleMode == kScaleStretch) {
+		if (_format->BytesPerPixel == 4)
+			stretchRows<uint32>(dst, dstPitch, &_rgbFrame[rect.left], _width, ySteps, width, screenHeight, _scale, _format);
+		else
+			stretchRows<uint16>(dst, dstPitch, &_rgbFrame[rect.left], _width, ySteps, width, screenHeight, _scale, _format);
+
+		return;
+	}
 
-	// Then update the whole screen
-	SDL_UpdateRect(_mainScreen, 0, 0, _mainScreen->w, _mainScreen->h);
+	const ScaleStep *xSteps = &_xSteps[screenRect.left];
+
+	if (_format->BytesPerPixel == 4)
+		scaleBilinear<uint32>(dst, dstPitch, &_rgbFrame[0], _width, xSteps, ySteps, screenWidth, screenHeight, _format);
+	else
+		scaleBilinear<uint16>(dst, dstPitch, &_rgbFrame[0], _width, xSteps, ySteps, screenWidth, screenHeight, _format);
+}
+
+void GraphicsManager::convertPixels(byte *dst, uint dstPitch, const byte *src, uint width, uint height) {
+	if (_highColor) {
+		if (_format->BytesPerPixel == 4)
+			convertHighColor<uint32>(dst, dstPitch, src, _framePitch, width, height, _highColorTables);
+		else
+			convertHighColor<uint16>(dst, dstPitch, src, _framePitch, width, height, _highColorTables);
+	} else {
+		if (_format->BytesPerPixel == 4)
+			convertIndexed<uint32>(dst, dstPitch, src, _framePitch, width, height, _palette);
+		else
+			convertIndexed<uint16>(dst, dstPitch, src, _framePitch, width, height, _palette);
+	}
 }
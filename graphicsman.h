@@ -23,23 +23,192 @@
 #ifndef GRAPHICSMAN_H
 #define GRAPHICSMAN_H
 
+#include <SDL_version.h>
+#include <vector>
 #include "types.h"
+#include "util.h"
+#include "videosink.h"
 
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_PixelFormat;
+
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+struct SDL_Window;
+struct SDL_Renderer;
+struct SDL_Texture;
+#else
 struct SDL_Surface;
+#endif
 
-class GraphicsManager {
+/**
+ * Where a screen pixel gets sampled from when filtering: between frame
+ * pixels index0 and index1, with weight/256 of index1.
+ */
+struct ScaleStep {
+	uint index0, index1;
+	uint weight;
+};
+
+/**
+ * The screen. Frames are put together by the decoding thread through the
+ * VideoSink side, then converted and shown by the thread that called
+ * init() (present()). Up to three finished frames can wait in
+ * between, so one side doesn't have to wait for the other.
+ *
+ * There must be exactly one thread on each side. blit(), setPalette(),
+ * update() and finish() are only for the decoding thread, and present()
+ * and stop() are only for the thread that called init(). The frame being
+ * filled is kept outside of the lock, so a second decoding thread would
+ * break it without any warning. isStopped() can be called from anywhere.
+ *
+ * With SDL 2, frames are converted straight into a streaming texture, and
+ * the renderer shows them in step with the display when it can. With SDL
+ * 1.2, they're converted into the software screen surface.
+ */
+class GraphicsManager : public VideoSink {
 public:
 	GraphicsManager();
 	~GraphicsManager();
 
-	bool init(uint width, uint height, bool highColor);
+	/**
+	 * Open a screen for width x height frames. The frames get scaled up to
+	 * screenWidth x screenHeight as they're converted: whole multiples of
+	 * the frame size just repeat pixels, a whole multiple across with any
+	 * height blends rows together (for aspect ratio correction), and any
+	 * other size gets bilinear filtering.
+	 */
+	bool init(uint width, uint height, bool highColor, uint screenWidth, uint screenHeight);
+
+	/** Decoding thread only */
 	void blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch);
-	void update();
-	void setPalette(const byte *ptr, uint start, uint count);
+
+	/**
+	 * Hand the frame that was put together since the last update over to
+	 * be shown. Only the areas that were blitted get converted and sent to
+	 * the screen. If no frame is free, this waits until one is.
+	 *
+	 * Decoding thread only.
+	 */
+	void update(uint32 time);
+
+	/**
+	 * Change colors of the palette. The whole frame that gets handed over
+	 * next is shown with the new colors, but only the areas blitted into it
+	 * get converted again. Decoding thread only.
+	 *
+	 * @return true if any color changed
+	 */
+	bool setPalette(const byte *ptr, uint start, uint count);
+
+	/**
+	 * Let present() know that there are no more frames coming. Decoding
+	 * thread only.
+	 */
+	void finish();
+
+	/**
+	 * @return true once stop() was called, after which frames are dropped
+	 */
+	bool isStopped();
+
+	/**
+	 * Show the next frame that was handed over, waiting up to timeout
+	 * milliseconds for one. Only colors that changed since the last frame
+	 * shown get converted to the screen's format again. Only for the
+	 * thread that called init().
+	 *
+	 * @return false once there won't be any more frames
+	 */
+	bool present(uint32 timeout);
+
+	/**
+	 * Stop showing frames. The decoding side isn't held up by update() any
+	 * longer and can check isStopped() to quit. Only for the thread that
+	 * called init().
+	 */
+	void stop();
 
 private:
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	SDL_Window *_window;
+	SDL_Renderer *_renderer;
+	SDL_Texture *_texture;
+#else
 	SDL_Surface *_mainScreen;
-	SDL_Surface *_workingScreen;
+#endif
+
+	// The format of the pixels on the screen
+	SDL_PixelFormat *_format;
+	uint _width, _height;
+	bool _highColor;
+
+	// Scaling. When the screen is a whole multiple of the frame across
+	// (_scale), pixels are repeated across. Rows are repeated too if the
+	// screen is the same multiple down, or else blended together through
+	// _ySteps, like when correcting the aspect ratio. Any other screen size
+	// gets bilinear filtering. Both blending and filtering need the frame
+	// pixels around the dirty areas, so _rgbFrame keeps all of the last
+	// frame as 0x00RRGGBB for them.
+	enum ScaleMode {
+		kScaleRepeat,
+		kScaleStretch,
+		kScaleFilter
+	};
+
+	uint _screenWidth, _screenHeight;
+	ScaleMode _scaleMode;
+	uint _scale;
+	std::vector<uint32> _rowBuffer;
+	std::vector<ScaleStep> _xSteps, _ySteps;
+	std::vector<uint32> _rgbFrame;
+	uint32 _rgbPalette[256];
+	uint32 _rgbHighColorTables[2][256];
+
+	// RGB565 pixels, as pixels in the screen's format. The first table
+	// is indexed by the high byte and the second one by the low byte, and
+	// the converted pixel is the two entries or'ed together.
+	uint32 _highColorTables[2][256];
+
+	// The palette as the decoder last set it
+	byte _colors[256 * 3];
+	bool _newPalette;
+
+	// The palette on the screen, both as given and as pixels in the
+	// screen's format
+	byte _screenColors[256 * 3];
+	uint32 _palette[256];
+
+	// A frame on its way to the screen. Only the dirty areas hold pixels of
+	// this frame; the screen already shows the rest.
+	struct Frame {
+		byte *pixels;
+		std::vector<Rect> dirtyRects;
+		bool newPalette;
+		byte colors[256 * 3];
+	};
+
+	enum {
+		kFrameCount = 3
+	};
+
+	// The frames are filled and shown in order. The decoder fills
+	// _frames[_fillFrame], and present() shows _frames[_showFrame] once
+	// _queuedFrames says there's one waiting. The counters and flags are
+	// guarded by _mutex.
+	Frame _frames[kFrameCount];
+	uint _framePitch;
+	uint _fillFrame, _showFrame, _queuedFrames;
+	bool _filling, _finished, _stopped;
+	SDL_mutex *_mutex;
+	SDL_cond *_frameReady, *_frameFree;
+
+	Frame *getFillFrame();
+	void addDirtyRect(Frame &frame, const Rect &rect);
+	void showFrame(Frame &frame);
+	Rect getScreenRect(const Rect &rect) const;
+	void convertRect(const Frame &frame, const Rect &rect, const Rect &screenRect, byte *dst, uint dstPitch);
+	void convertPixels(byte *dst, uint dstPitch, const byte *src, uint width, uint height);
 };
 
 #endif
@@ -21,13 +21,23 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <SDL.h>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 #include "audioman.h"
+#include "exportsink.h"
 #include "graphicsman.h"
 #include "smushvideo.h"
 
-#ifdef _WIN32
+// SDL 2 brings its own WinMain in SDL2main
+#if defined(_WIN32) && !SDL_VERSION_ATLEAST(2, 0, 0)
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -37,53 +47,189 @@ int __stdcall WinMain(HINSTANCE /*hInst*/, HINSTANCE /*hPrevInst*/,  LPSTR /*lpC
 }
 #endif
 
+// Frames exported to stdout need it to themselves, so anything else that
+// gets printed goes to stderr instead
+static FILE *takeStdout() {
+#ifdef _WIN32
+	int fd = _dup(1);
+	_dup2(2, 1);
+	_setmode(fd, _O_BINARY);
+	return _fdopen(fd, "wb");
+#else
+	int fd = dup(1);
+	dup2(2, 1);
+	return fdopen(fd, "wb");
+#endif
+}
+
 void printUsage(const char *appName) {
-	printf("Usage: %s <video>\n", appName);
+	printf("Usage: %s [options] <video>\n", appName);
+	printf("Options:\n");
+	printf("  -s <scale>             Scale the video up by a whole number\n");
+	printf("  -g <width>x<height>    Scale the video to fit a window of this size\n");
+	printf("  -a                     Stretch 200 line videos to 240 lines for 4:3 screens\n");
+	printf("  -n                     Decode as fast as possible without showing anything\n");
+	printf("  -o <file>              Decode as fast as possible into a file, or - for stdout\n");
+	printf("  -f <format>            Format for -o: y4m (the default), rgb24, or rgba\n");
+	printf("  -r <rate>[/<divisor>]  Repeat or drop frames for -o to match this frame rate\n");
+	printf("  -d <prefix>            Decode as fast as possible into <prefix><frame>.png files\n");
+	printf("  -i                     Write indexed PNGs for -d, for videos with a palette\n");
+	printf("  -j <threads>           Compress PNGs for -d on this many threads (4 by default)\n");
 }
 
 #define SMUSHPLAY_VERSION "0.0.1"
 
 int main(int argc, char **argv) {
+	uint scale = 1;
+	uint screenWidth = 0, screenHeight = 0;
+	bool aspectRatioCorrection = false;
+	bool headless = false;
+	const char *exportFileName = 0;
+	ExportVideoSink::Format exportFormat = ExportVideoSink::kFormatY4M;
+	uint exportRate = 0, exportRateDivisor = 1;
+	const char *pngPrefix = 0;
+	bool pngIndexed = false;
+	uint pngThreads = 4;
+	bool exportOptions = false, pngOptions = false;
+	int arg = 1;
+
+	for (; arg < argc - 1 && argv[arg][0] == '-'; arg++) {
+		bool hasValue = arg + 1 < argc - 1;
+
+		if (!strcmp(argv[arg], "-s") && hasValue && sscanf(argv[arg + 1], "%u", &scale) == 1 && scale > 0) {
+			arg++;
+		} else if (!strcmp(argv[arg], "-g") && hasValue && sscanf(argv[arg + 1], "%ux%u", &screenWidth, &screenHeight) == 2 && screenWidth > 0 && screenHeight > 0) {
+			arg++;
+		} else if (!strcmp(argv[arg], "-a")) {
+			aspectRatioCorrection = true;
+		} else if (!strcmp(argv[arg], "-n")) {
+			headless = true;
+		} else if (!strcmp(argv[arg], "-o") && hasValue) {
+			exportFileName = argv[++arg];
+		} else if (!strcmp(argv[arg], "-f") && hasValue && !strcmp(argv[arg + 1], "y4m")) {
+			exportFormat = ExportVideoSink::kFormatY4M;
+			exportOptions = true;
+			arg++;
+		} else if (!strcmp(argv[arg], "-f") && hasValue && !strcmp(argv[arg + 1], "rgb24")) {
+			exportFormat = ExportVideoSink::kFormatRGB24;
+			exportOptions = true;
+			arg++;
+		} else if (!strcmp(argv[arg], "-f") && hasValue && !strcmp(argv[arg + 1], "rgba")) {
+			exportFormat = ExportVideoSink::kFormatRGBA;
+			exportOptions = true;
+			arg++;
+		} else if (!strcmp(argv[arg], "-r") && hasValue && sscanf(argv[arg + 1], "%u/%u", &exportRate, &exportRateDivisor) >= 1 && exportRate > 0 && exportRateDivisor > 0) {
+			exportOptions = true;
+			arg++;
+		} else if (!strcmp(argv[arg], "-d") && hasValue) {
+			pngPrefix = argv[++arg];
+		} else if (!strcmp(argv[arg], "-i")) {
+			pngIndexed = true;
+			pngOptions = true;
+		} else if (!strcmp(argv[arg], "-j") && hasValue && sscanf(argv[arg + 1], "%u", &pngThreads) == 1) {
+			pngOptions = true;
+			arg++;
+		} else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (arg != argc - 1) {
+		printUsage(argv[0]);
+		return 0;
+	}
+
+	// Only one of -o and -d can be used at once, and their options mean
+	// nothing without them
+	if ((exportFileName && pngPrefix) || (exportOptions && !exportFileName) || (pngOptions && !pngPrefix)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	const char *fileName = argv[arg];
+	FILE *exportFile = 0;
+
+	if (pngPrefix)
+		headless = true;
+
+	if (exportFileName) {
+		headless = true;
+		exportFile = strcmp(exportFileName, "-") ? fopen(exportFileName, "wb") : takeStdout();
+
+		if (!exportFile) {
+			fprintf(stderr, "Failed to open '%s' for writing\n", exportFileName);
+			return 1;
+		}
+	}
+
 	printf("\nsmushplay " SMUSHPLAY_VERSION " - SMUSH v1/v2 Player\n");
 	printf("Plays LucasArts SMUSH videos\n");
 	printf("Written by Matthew Hoops (clone2727)\n");
 	printf("Based on ScummVM and ResidualVM's SMUSH player\n");
 	printf("See COPYING for the license\n\n");
 
-	if (argc < 2) {
-		printUsage(argv[0]);
-		return 0;
-	}
-
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
+	if (SDL_Init(headless ? 0 : (SDL_INIT_VIDEO | SDL_INIT_AUDIO)) < 0) {
 		fprintf(stderr, "Failed to initialize SDL\n");
 		return 1;
 	}
 
 	atexit(SDL_Quit);
 
-	// Initialize audio here
+	// Initialize audio here. Decoding without showing the video doesn't
+	// play any sound, so it doesn't need an audio device either.
 	AudioManager audio;
-	if (!audio.init()) {
+	if (!headless && !audio.init()) {
 		fprintf(stderr, "Failed to initialize SDL audio\n");
 		return 1;
 	}
 
-	SMUSHVideo video(audio);
-	if (!video.load(argv[1])) {
-		fprintf(stderr, "Failed to play file '%s'\n", argv[1]);
+	SMUSHVideo video(headless ? 0 : &audio);
+	if (!video.load(fileName)) {
+		fprintf(stderr, "Failed to play file '%s'\n", fileName);
 		return 1;
 	}
 
+	if (exportFile) {
+		// Without a rate to match, the video's own goes in the header
+		uint rateNumerator = exportRate, rateDenominator = exportRateDivisor;
+		if (exportRate == 0)
+			video.getFrameRate(rateNumerator, rateDenominator);
+
+		ExportVideoSink sink(exportFile, exportFormat, video.getWidth(), video.getHeight(), video.isHighColor(), rateNumerator, rateDenominator, exportRate != 0);
+		bool failed = !video.decode(sink) || sink.isStopped();
+		if (fclose(exportFile) != 0)
+			failed = true;
+
+		return failed ? 1 : 0;
+	}
+
+	if (pngPrefix) {
+		PNGVideoSink sink(pngPrefix, video.getWidth(), video.getHeight(), video.isHighColor(), pngIndexed, pngThreads);
+		bool decoded = video.decode(sink);
+		return (!decoded || sink.isStopped()) ? 1 : 0;
+	}
+
+	if (headless) {
+		NullVideoSink sink;
+		return video.decode(sink) ? 0 : 1;
+	}
+
+	if (screenWidth == 0) {
+		screenWidth = video.getWidth() * scale;
+		screenHeight = video.getHeight() * scale;
+
+		// 320x200 was meant to fill a 4:3 screen
+		if (aspectRatioCorrection && video.getHeight() == 200)
+			screenHeight = 240 * scale;
+	}
+
 	GraphicsManager gfx;
-	if (!gfx.init(video.getWidth(), video.getHeight(), video.isHighColor())) {
+	if (!gfx.init(video.getWidth(), video.getHeight(), video.isHighColor(), screenWidth, screenHeight)) {
 		fprintf(stderr, "Failed to initialize SDL screen\n");
 		return 1;
 	}
 
-	// Add our fun title
-	SDL_WM_SetCaption("smushplay", "smushplay");
-
 	// Finally, play the damned thing
 	video.play(gfx);
 
@@ -25,6 +25,7 @@
 
 #include <SDL.h>
 #include <SDL_endian.h>
+#include <vector>
 #include <zlib.h>
 #include "audioman.h"
 #include "audiostream.h"
@@ -32,11 +33,13 @@
 #include "codec37.h"
 #include "codec47.h"
 #include "codec48.h"
+#include "graphicsman.h"
 #include "pcm.h"
 #include "smushchannel.h"
 #include "smushvideo.h"
 #include "stream.h"
 #include "util.h"
+#include "videosink.h"
 #include "vima.h"
 
 // OVERALL STATUS:
@@ -47,7 +50,7 @@
 // A/V Sync could be improved
 
 // ANIM:
-// Rebel Assault: Decodes a few videos, missing several codecs, missing ghost support, missing negative coordinate handling
+// Rebel Assault: Decodes a few videos, missing several codecs, ghost support is a guess
 // Rebel Assault II: Decodes most videos, missing at least one codec
 // The Dig/Full Throttle/CMI/Shadows of the Empire/Grim Demo/Outlaws/Mysteries of the Sith: Decodes all videos
 // Mortimer: Some videos work, but looks like it scales up low-res frames; missing codec 23
@@ -61,21 +64,23 @@
 // VIMA audio works
 
 
-SMUSHVideo::SMUSHVideo(AudioManager &audio) : _audio(&audio) {
+SMUSHVideo::SMUSHVideo(AudioManager *audio) : _audio(audio) {
 	_file = 0;
-	_buffer = _storedFrame = 0;
+	_buffer = _storedFrame = _layer = 0;
 	_storeFrame = false;
+	_redrawFrame = false;
+	_lastFrameCodec = 0;
 	_codec37 = 0;
 	_codec47 = 0;
 	_codec48 = 0;
 	_blocky16 = 0;
+	_gfx = 0;
 	_runSoundHeaderCheck = false;
 	_ranIACTSoundCheck = false;
 	_audioChannels = 0;
 	_width = _height = 0;
 	_iactStream = 0;
 	_iactBuffer = 0;
-	_vimaDestTable = 0;
 	_frameRate = 0;
 	_audioRate = 0;
 }
@@ -132,7 +137,8 @@ bool SMUSHVideo::load(const char *fileName) {
 }
 
 void SMUSHVideo::close() {
-	_audio->stopAll();
+	if (_audio)
+		_audio->stopAll();
 
 	if (_file) {
 		delete _file;
@@ -144,6 +150,13 @@ void SMUSHVideo::close() {
 		delete[] _storedFrame;
 		_storedFrame = 0;
 
+		delete[] _layer;
+		_layer = 0;
+		_layerRect = Rect();
+
+		_lastFrameCodec = 0;
+		_staleRect = Rect();
+
 		delete _codec37;
 		_codec37 = 0;
 
@@ -161,12 +174,10 @@ void SMUSHVideo::close() {
 		delete[] _iactBuffer;
 		_iactBuffer = 0;
 
-		delete[] _vimaDestTable;
-		_vimaDestTable = 0;
-
 		_runSoundHeaderCheck = false;
 		_ranIACTSoundCheck = false;
 		_storeFrame = false;
+		_redrawFrame = false;
 		_audioChannels = 0;
 		_width = _height = 0;
 		_frameRate = 0;
@@ -191,6 +202,17 @@ uint SMUSHVideo::getHeight() const {
 	return _height;
 }
 
+void SMUSHVideo::getFrameRate(uint &numerator, uint &denominator) const {
+	// SANM stores the frame rate as time between frames
+	if (_mainTag == MKTAG('S', 'A', 'N', 'M')) {
+		numerator = 1000000;
+		denominator = _frameRate;
+	} else {
+		numerator = _frameRate;
+		denominator = 1;
+	}
+}
+
 uint32 SMUSHVideo::getNextFrameTime(uint32 curFrame) const {
 	// SANM stores the frame rate as time between frames
 	if (_mainTag == MKTAG('S', 'A', 'N', 'M'))
@@ -204,33 +226,77 @@ void SMUSHVideo::play(GraphicsManager &gfx) {
 	if (!isLoaded())
 		return;
 
+	// Frames get decoded on a thread of their own, so a slow screen update
+	// doesn't hold up the next frame. Showing them and handling events has
+	// to stay on this thread, since it's the one that set up the screen.
+	_gfx = &gfx;
+#if SDL_VERSION_ATLEAST(2, 0, 0)
+	SDL_Thread *thread = SDL_CreateThread(decodeThread, "decode", this);
+#else
+	SDL_Thread *thread = SDL_CreateThread(decodeThread, this);
+#endif
+
+	if (!thread) {
+		fprintf(stderr, "Failed to create the decoding thread\n");
+		_gfx = 0;
+		return;
+	}
+
+	for (;;) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event))
+			if (event.type == SDL_QUIT)
+				gfx.stop();
+
+		if (!gfx.present(10))
+			break;
+	}
+
+	SDL_WaitThread(thread, 0);
+	_gfx = 0;
+}
+
+int SMUSHVideo::decodeThread(void *data) {
+	SMUSHVideo *video = (SMUSHVideo *)data;
+	video->decodeFrames(*video->_gfx, true);
+	return 0;
+}
+
+bool SMUSHVideo::decode(VideoSink &sink) {
+	return isLoaded() && decodeFrames(sink, false);
+}
+
+bool SMUSHVideo::decodeFrames(VideoSink &sink, bool realTime) {
 	// Set the palette from the header for 8bpp videos
 	if (!isHighColor())
-		gfx.setPalette(_palette, 0, 256);
+		setPalette(sink);
 
 	uint32 startTime = SDL_GetTicks();
 	uint curFrame = 0;
 
-	while (curFrame < _frameCount) {
-		if (SDL_GetTicks() > startTime + getNextFrameTime(curFrame)) {
-			if (!handleFrame(gfx)) {
+	while (curFrame < _frameCount && !sink.isStopped()) {
+		if (!realTime || SDL_GetTicks() > startTime + getNextFrameTime(curFrame)) {
+			if (!handleFrame(sink)) {
 				fprintf(stderr, "Problem during frame decode\n");
-				return;
+				break;
 			}
 
-			gfx.update();
+			sink.update(getNextFrameTime(curFrame));
 			curFrame++;
+		} else {
+			SDL_Delay(10);
 		}
+	}
 
-		SDL_Event event;
-		while (SDL_PollEvent(&event))
-			if (event.type == SDL_QUIT)
-				return;
-
-		SDL_Delay(10);
+	if (curFrame == _frameCount) {
+		if (realTime)
+			printf("Done!\n");
+		else
+			printf("Decoded %u frames in %u ms\n", curFrame, SDL_GetTicks() - startTime);
 	}
 
-	printf("Done!\n");
+	sink.finish();
+	return curFrame == _frameCount;
 }
 
 bool SMUSHVideo::readHeader() {
@@ -286,7 +352,7 @@ bool SMUSHVideo::readHeader() {
 	return false;
 }
 
-bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
+bool SMUSHVideo::handleFrame(VideoSink &sink) {
 	uint32 tag = _file->readUint32BE();
 	uint32 size = _file->readUint32BE();
 	uint32 pos = _file->pos();
@@ -304,6 +370,9 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 	if (tag != MKTAG('F', 'R', 'M', 'E'))
 		return false;
 
+	// Ghosting only works off what was drawn in this frame
+	clearLayer();
+
 	uint32 bytesLeft = size;
 	while (bytesLeft > 0) {
 		uint32 subType = _file->readUint32BE();
@@ -320,16 +389,16 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 
 		switch (subType) {
 		case MKTAG('B', 'l', '1', '6'):
-			result = handleBlocky16(gfx, subSize);
+			result = handleBlocky16(sink, subSize);
 			break;
 		case MKTAG('F', 'A', 'D', 'E'):
 			// TODO: Seems to not be needed as XPAL is used in v1 instead?
 			break;
 		case MKTAG('F', 'O', 'B', 'J'):
-			result = handleFrameObject(gfx, subSize);
+			result = handleFrameObject(sink, subSize);
 			break;
 		case MKTAG('F', 'T', 'C', 'H'):
-			result = handleFetch(subSize);
+			result = handleFetch(sink, subSize);
 			break;
 		case MKTAG('G', 'A', 'M', 'E'):
 			// TODO: SMUSH v1 interaction (?)
@@ -338,7 +407,7 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 			// TODO: SMUSH v1 interaction (?)
 			break;
 		case MKTAG('G', 'O', 'S', 'T'):
-			result = handleGhost(subSize);
+			result = handleGhost(sink, subSize);
 			break;
 		case MKTAG('I', 'A', 'C', 'T'):
 			result = handleIACT(subSize);
@@ -347,12 +416,13 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 			// TODO: Unknown, found in RA2's 06PLAY1.SAN
 			break;
 		case MKTAG('N', 'P', 'A', 'L'):
-			result = handleNewPalette(gfx, subSize);
+			result = handleNewPalette(sink, subSize);
 			break;
 		case MKTAG('P', 'S', 'A', 'D'):
 		case MKTAG('P', 'S', 'D', '2'):
 		case MKTAG('P', 'V', 'O', 'C'):
-			result = handleSoundFrame(subType, subSize);
+			if (_audio)
+				result = handleSoundFrame(subType, subSize);
 			break;
 		case MKTAG('S', 'E', 'G', 'A'):
 			// TODO: Unknown, found in RA Sega CD
@@ -368,14 +438,15 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 			// TODO: Text Resource
 			break;
 		case MKTAG('W', 'a', 'v', 'e'):
-			result = handleVIMA(subSize - 12);
+			if (_audio)
+				result = handleVIMA(subSize - 12);
 			break;
 		case MKTAG('X', 'P', 'A', 'L'):
-			result = handleDeltaPalette(gfx, subSize);
+			result = handleDeltaPalette(sink, subSize);
 			break;
 		case MKTAG('Z', 'F', 'O', 'B'):
 			// Zipped Frame Object (ScummVM-compressed)
-			result = handleZlibFrameObject(gfx, subSize);
+			result = handleZlibFrameObject(sink, subSize);
 			break;
 		default:
 			// TODO: Other types
@@ -390,10 +461,24 @@ bool SMUSHVideo::handleFrame(GraphicsManager &gfx) {
 	}
 
 	_file->seek(pos + size + (size & 1), SEEK_SET);
+
+	// Show the frame with the new colors
+	if (_redrawFrame) {
+		sink.blit(_buffer, 0, 0, _width, _height, _pitch);
+		_redrawFrame = false;
+	}
+
 	return true;
 }
 
-bool SMUSHVideo::handleNewPalette(GraphicsManager &gfx, uint32 size) {
+void SMUSHVideo::setPalette(VideoSink &sink) {
+	// XPAL chunks often leave most of the colors alone, and some fades
+	// keep going after they stop changing anything
+	if (sink.setPalette(_palette, 0, 256))
+		_redrawFrame = true;
+}
+
+bool SMUSHVideo::handleNewPalette(VideoSink &sink, uint32 size) {
 	// Load a new palette
 
 	if (size < 256 * 3) {
@@ -402,43 +487,35 @@ bool SMUSHVideo::handleNewPalette(GraphicsManager &gfx, uint32 size) {
 	}
 
 	_file->read(_palette, 256 * 3);
-	gfx.setPalette(_palette, 0, 256);
+	setPalette(sink);
 	return true;
 }
 
-static byte deltaColor(byte pal, int16 delta) {
-	int t = (pal * 129 + delta) / 128;
-	if (t < 0)
-		t = 0;
-	else if (t > 255)
-		t = 255;
-	return t;
-}
-
-bool SMUSHVideo::handleDeltaPalette(GraphicsManager &gfx, uint32 size) {
+bool SMUSHVideo::handleDeltaPalette(VideoSink &sink, uint32 size) {
 	// Decode a delta palette
 
 	if (size == 256 * 3 * 3 + 4) {
 		_file->seek(4, SEEK_CUR);
-
-		for (uint16 i = 0; i < 256 * 3; i++)
-			_deltaPalette[i] = _file->readUint16LE();
-
+		readDeltaPalette();
 		_file->read(_palette, 256 * 3);
-		gfx.setPalette(_palette, 0, 256);
+		setPalette(sink);
 		return true;
 	} else if (size == 6 || size == 4) {
-		for (uint16 i = 0; i < 256 * 3; i++)
-			_palette[i] = deltaColor(_palette[i], _deltaPalette[i]);
+		// Each component becomes (pal * 129 + delta) / 128. Anything that
+		// would round differently with a shift is negative, and gets
+		// clamped to 0 either way. There are no branches, so the loop can
+		// be vectorized.
+		for (uint i = 0; i < 256 * 3; i++) {
+			int color = (_palette[i] * 129 + _deltaPalette[i]) >> 7;
+			_palette[i] = CLIP(color, 0, 255);
+		}
 
-		gfx.setPalette(_palette, 0, 256);
+		setPalette(sink);
 		return true;
 	} else if (size == 256 * 3 * 2 + 4) {
 		// SMUSH v1 only
 		_file->seek(4, SEEK_CUR);
-
-		for (uint16 i = 0; i < 256 * 3; i++)
-			_deltaPalette[i] = _file->readUint16LE();
+		readDeltaPalette();
 		return true;
 	}
 
@@ -446,22 +523,29 @@ bool SMUSHVideo::handleDeltaPalette(GraphicsManager &gfx, uint32 size) {
 	return false;
 }
 
-bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, uint32 size) {
-	return handleFrameObject(gfx, _file, size);
+void SMUSHVideo::readDeltaPalette() {
+	_file->read(_deltaPalette, sizeof(_deltaPalette));
+
+	for (uint i = 0; i < 256 * 3; i++)
+		_deltaPalette[i] = (int16)FROM_LE_16(_deltaPalette[i]);
+}
+
+bool SMUSHVideo::handleFrameObject(VideoSink &sink, uint32 size) {
+	return handleFrameObject(sink, _file, size);
 }
 
-bool SMUSHVideo::handleZlibFrameObject(GraphicsManager &gfx, uint32 size) {
+bool SMUSHVideo::handleZlibFrameObject(VideoSink &sink, uint32 size) {
 	SeekableReadStream *stream = decompressZlibFrameObject(size);
 
 	if (!stream)
 		return false;
 
-	bool result = handleFrameObject(gfx, stream, stream->size());
+	bool result = handleFrameObject(sink, stream, stream->size());
 	delete stream;
 	return result;
 }
 
-bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *stream, uint32 size) {
+bool SMUSHVideo::handleFrameObject(VideoSink &sink, SeekableReadStream *stream, uint32 size) {
 	// Decode a frame object
 
 	if (isHighColor()) {
@@ -490,12 +574,19 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 			fprintf(stderr, "Modified codec %d coordinates %d, %d\n", codec, width, height);
 			return true;
 		}
-	} else if (left < 0 || top < 0 || left + width > (int)_width || top + height > (int)_height) {
-		// TODO: We should be drawing partial frames
-		fprintf(stderr, "Bad codec %d coordinates %d, %d, %d, %d\n", codec, left, top, width, height);
+	} else if (left >= (int)_width || top >= (int)_height || left + width <= 0 || top + height <= 0) {
+		// Completely off screen. Anything that's partially on the screen
+		// gets clipped by the codecs.
 		return true;
 	}
 
+	// The transparent codecs also draw onto the layer, once there is one
+	bool layered = codec == 1 || codec == 3 || codec == 21 || codec == 31 || codec == 32;
+
+	// The blocks the whole frame codecs changed
+	const byte *dirtyBlocks = 0;
+	int blockSize = 0;
+
 	switch (codec) {
 	case 1:
 	case 3:
@@ -546,6 +637,12 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 
 		_codec37->decode(_buffer, ptr);
 		delete[] ptr;
+
+		// The block map only matches the screen if there's no padding
+		if (_width % 4 == 0) {
+			dirtyBlocks = _codec37->getDirtyBlocks();
+			blockSize = 4;
+		}
 		} break;
 	case 45:
 		// TODO: Used by RA2's 14PLAY.SAN
@@ -561,6 +658,9 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 
 		_codec47->decode(_buffer, ptr);
 		delete[] ptr;
+
+		dirtyBlocks = _codec47->getDirtyBlocks();
+		blockSize = 8;
 		} break;
 	case 48: {
 		// Used by Mysteries of the Sith
@@ -573,6 +673,9 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 
 		_codec48->decode(_buffer, ptr);
 		delete[] ptr;
+
+		dirtyBlocks = _codec48->getDirtyBlocks();
+		blockSize = 8;
 		} break;
 	default:
 		// TODO: Lots of other Rebel Assault ones
@@ -582,6 +685,30 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 		break;
 	}
 
+	// Ideally, the blits should be at the end of the FRME block, but it
+	// seems that breaks things like the video in Rebel Assault of Cmdr.
+	// Farrell coming in to save you.
+	if (layered) {
+		Rect rect(left, top, left + width, top + height);
+		rect.clip(_width, _height);
+
+		_layerRect.extend(rect);
+		_staleRect.extend(rect);
+		blitRect(sink, _buffer, rect);
+	} else if (codec == 37 || codec == 47 || codec == 48) {
+		// The block map is relative to the codec's own last frame, so it's
+		// only of use if nothing else replaced the whole frame in between
+		if (dirtyBlocks && codec == _lastFrameCodec) {
+			blitDirtyBlocks(sink, _buffer, dirtyBlocks, blockSize);
+			blitRect(sink, _buffer, _staleRect);
+		} else {
+			sink.blit(_buffer, 0, 0, _width, _height, _pitch);
+		}
+
+		_lastFrameCodec = codec;
+		_staleRect = Rect();
+	}
+
 	if (_storeFrame) {
 		if (!_storedFrame)
 			_storedFrame = new byte[_pitch * _height];
@@ -590,10 +717,6 @@ bool SMUSHVideo::handleFrameObject(GraphicsManager &gfx, SeekableReadStream *str
 		_storeFrame = false;
 	}
 
-	// Ideally, this call should be at the end of the FRME block, but it
-	// seems that breaks things like the video in Rebel Assault of Cmdr.
-	// Farrell coming in to save you.
-	gfx.blit(_buffer, 0, 0, _width, _height, _pitch);
 	return true;
 }
 
@@ -606,7 +729,7 @@ bool SMUSHVideo::handleStore(uint32 size) {
 	return size >= 4;
 }
 
-bool SMUSHVideo::handleFetch(uint32 size) {
+bool SMUSHVideo::handleFetch(VideoSink &sink, uint32 size) {
 	// Restore an previous frame object
 	int32 xOffset = 0, yOffset = 0;
 
@@ -625,29 +748,111 @@ bool SMUSHVideo::handleFetch(uint32 size) {
 		yOffset = _file->readSint32BE();
 
 	if (_storedFrame && _buffer) {
-		for (uint y = 0; y < _height; y++) {
-			int realY = yOffset + y;
-			if (realY < 0 || realY >= (int)_height)
-				continue;
+		// Clip the stored frame against the screen once, then copy whole rows
+		int srcX = MAX<int>(0, -xOffset);
+		int srcY = MAX<int>(0, -yOffset);
+		int rowWidth = MIN<int>(_width, (int)_width - xOffset) - srcX;
+		int rowCount = MIN<int>(_height, (int)_height - yOffset) - srcY;
+
+		for (int y = 0; y < rowCount && rowWidth > 0; y++) {
+			const byte *src = _storedFrame + (srcY + y) * _pitch + srcX;
+			memcpy(_buffer + (srcY + y + yOffset) * _pitch + srcX + xOffset, src, rowWidth);
+		}
 
-			for (uint x = 0; x < _width; x++) {
-				int realX = xOffset + x;
-				if (realX < 0 || realX >= (int)_width)	
-					continue;
+		Rect rect(srcX + xOffset, srcY + yOffset, srcX + xOffset + rowWidth, srcY + yOffset + rowCount);
+		_staleRect.extend(rect);
+		blitRect(sink, _buffer, rect);
+	}
 
-				_buffer[realY * _pitch + realX] = _storedFrame[y * _pitch + x];
-			}
+	return true;
+}
+
+// Copy a run of pixels, except for the ones that are 0 (transparent) in
+// the source. Eight pixels are blended at a time using a mask of the
+// non-zero source bytes.
+static void copyTransparent(byte *dst, const byte *src, uint length) {
+	const uint64 lowBits = 0x7F7F7F7F7F7F7F7FULL;
+
+	for (; length >= 8; length -= 8) {
+		uint64 srcPixels;
+		memcpy(&srcPixels, src, 8);
+
+		// The top bit of each byte is set if that source pixel is not 0
+		uint64 mask = (((srcPixels & lowBits) + lowBits) | srcPixels) & ~lowBits;
+
+		if (mask == ~lowBits) {
+			memcpy(dst, src, 8);
+		} else if (mask != 0) {
+			mask = (mask >> 7) * 0xFF;
+
+			uint64 dstPixels;
+			memcpy(&dstPixels, dst, 8);
+			dstPixels = (srcPixels & mask) | (dstPixels & ~mask);
+			memcpy(dst, &dstPixels, 8);
 		}
+
+		src += 8;
+		dst += 8;
 	}
 
-	return true;
+	for (; length > 0; length--) {
+		if (*src)
+			*dst = *src;
+
+		src++;
+		dst++;
+	}
+}
+
+// Draw a run of pixels starting at x on a row, leaving out the part that
+// falls outside of the clip rectangle
+static void drawRun(byte *row, int x, const byte *src, int length, const Rect &clip, bool transparent) {
+	if (x < clip.left) {
+		src += clip.left - x;
+		length -= clip.left - x;
+		x = clip.left;
+	}
+
+	length = MIN(length, clip.right - x);
+	if (length <= 0)
+		return;
+
+	if (transparent)
+		copyTransparent(row + x, src, length);
+	else
+		memcpy(row + x, src, length);
+}
+
+// Fill a run of pixels starting at x on a row, leaving out the part that
+// falls outside of the clip rectangle
+static void fillRun(byte *row, int x, byte color, int length, const Rect &clip) {
+	if (x < clip.left) {
+		length -= clip.left - x;
+		x = clip.left;
+	}
+
+	length = MIN(length, clip.right - x);
+	if (length > 0)
+		memset(row + x, color, length);
 }
 
 void SMUSHVideo::decodeCodec1(SeekableReadStream *stream, int left, int top, uint width, uint height) {
 	// This is very similar to the bomp compression
+	Rect clip(left, top, left + width, top + height);
+	clip.clip(_width, _height);
+
 	for (uint y = 0; y < height; y++) {
 		uint16 lineSize = stream->readUint16LE();
-		byte *dst = _buffer + (top + y) * _pitch + left;
+		int realY = top + y;
+
+		if (realY < clip.top || realY >= clip.bottom) {
+			stream->seek(lineSize, SEEK_CUR);
+			continue;
+		}
+
+		byte *row = _buffer + realY * _pitch;
+		byte *layerRow = _layer ? _layer + realY * _pitch : 0;
+		int x = left;
 
 		while (lineSize > 0) {
 			byte code = stream->readByte();
@@ -658,22 +863,24 @@ void SMUSHVideo::decodeCodec1(SeekableReadStream *stream, int left, int top, uin
 				byte val = stream->readByte();
 				lineSize--;
 
-				if (val != 0)
-					memset(dst, val, length);
+				if (val != 0) {
+					fillRun(row, x, val, length, clip);
 
-				dst += length;
+					if (layerRow)
+						fillRun(layerRow, x, val, length, clip);
+				}
 			} else {
 				lineSize -= length;
 
-				while (length--) {
-					byte val = stream->readByte();
-
-					if (val)
-						*dst = val;
+				byte literal[128];
+				stream->read(literal, length);
+				drawRun(row, x, literal, length, clip, true);
 
-					dst++;
-				}
+				if (layerRow)
+					drawRun(layerRow, x, literal, length, clip, true);
 			}
+
+			x += length;
 		}
 	}
 }
@@ -810,6 +1017,10 @@ bool SMUSHVideo::handleIACT(uint32 size) {
 	uint16 trackFlags = _file->readUint16LE();
 
 	if (code == 8 && flags == 46) {
+		// Without anything to play it, the sound isn't worth queuing
+		if (!_audio)
+			return true;
+
 		if (!_ranIACTSoundCheck)
 			detectIACTType(trackFlags);
 
@@ -962,7 +1173,18 @@ bool SMUSHVideo::bufferIACTAudio(uint32 size) {
 	return true;
 }
 
-bool SMUSHVideo::handleGhost(uint32 size) {
+void SMUSHVideo::clearLayer() {
+	if (_layer && !_layerRect.isEmpty()) {
+		int width = _layerRect.right - _layerRect.left;
+
+		for (int y = _layerRect.top; y < _layerRect.bottom; y++)
+			memset(_layer + y * _pitch + _layerRect.left, 0, width);
+	}
+
+	_layerRect = Rect();
+}
+
+bool SMUSHVideo::handleGhost(VideoSink &sink, uint32 size) {
 	if (size != 12) {
 		fprintf(stderr, "Invalid ghost chunk (%d)\n", size);
 		return false;
@@ -977,54 +1199,97 @@ bool SMUSHVideo::handleGhost(uint32 size) {
 	// Level 5: 28, -190, 20
 
 	/* uint32 unk1 = */ _file->readUint32BE();
-	/* int32 unk2 = */ _file->readSint32BE();
-	/* int32 unk3 = */ _file->readSint32BE();
+	int32 startX = _file->readSint32BE();
+	int32 startY = _file->readSint32BE();
+
+	// In FNFINAL, it copies to startX through _width from (_width - startX)
+	// to 0. startY is possibly the first row to mirror.
+
+	// It works off of *only* what was decoded in this frame, which is what
+	// the layer holds. Only the part of the layer drawn to gets mirrored.
+	// Few videos use GOST, so the layer is only kept from the first one
+	// on, and this frame's objects weren't drawn onto it.
+	if (!_layer) {
+		if (_buffer)
+			_layer = new byte[_pitch * _height]();
+
+		return true;
+	}
+
+	if (_layerRect.isEmpty())
+		return true;
 
-	// unk2 seems to be the 'startX' parameter at least in FNFINAL.
-	// It copies to startX through _width from (_width - startX) to 0
-	// unk3 is possibly startY.
+	int firstX = MAX<int>(startX, _width - _layerRect.right + 1);
+	int lastX = MIN<int>(_width, _width - _layerRect.left + 1);
+	firstX = MAX(firstX, 1);
 
-	// However, it works off of *only* what was decoded in this frame.
-	// This code will need to be extended not to draw to the main buffer
-	// for each FOBJ.
+	int firstY = MAX<int>(startY, _layerRect.top);
 
+	for (int y = firstY; y < _layerRect.bottom; y++) {
+		const byte *src = _layer + y * _pitch;
+		byte *dst = _buffer + y * _pitch;
+
+		for (int x = firstX; x < lastX; x++) {
+			byte pixel = src[_width - x];
+
+			if (pixel != 0)
+				dst[x] = pixel;
+		}
+	}
+
+	Rect rect(firstX, firstY, lastX, _layerRect.bottom);
+	_staleRect.extend(rect);
+	blitRect(sink, _buffer, rect);
 	return true;
 }
 
 void SMUSHVideo::decodeCodec21(SeekableReadStream *stream, int left, int top, uint width, uint height) {
+	Rect clip(left, top, left + width, top + height);
+	clip.clip(_width, _height);
+
 	for (uint y = 0; y < height; y++) {
-		byte *dst = _buffer + _pitch * (y + top) + left;
 		uint16 lineSize = stream->readUint16LE();
 		uint32 pos = stream->pos();
+		int realY = top + y;
+
+		if (realY >= clip.top && realY < clip.bottom) {
+			byte *row = _buffer + realY * _pitch;
+			byte *layerRow = _layer ? _layer + realY * _pitch : 0;
+			int x = left;
+
+			int len = width;
+			do {
+				int offs = stream->readUint16LE();
+				x += offs;
+				len -= offs;
+				if (len <= 0)
+					break;
 
-		int len = width;
-		do {
-			int offs = stream->readUint16LE();
-			dst += offs;
-			len -= offs;
-			if (len <= 0)
-				break;
-
-			int w = stream->readUint16LE() + 1;
-			len -= w;
-			if (len < 0)
-				w += len;
+				int w = stream->readUint16LE() + 1;
+				len -= w;
+				if (len < 0)
+					w += len;
 
-			for (int i = 0; i < w; i++) {
-				byte color = stream->readByte();
+				while (w > 0) {
+					byte literal[256];
+					int chunk = MIN<int>(w, sizeof(literal));
+					stream->read(literal, chunk);
+					drawRun(row, x, literal, chunk, clip, true);
 
-				if (color != 0)
-					*dst = color;
+					if (layerRow)
+						drawRun(layerRow, x, literal, chunk, clip, true);
 
-				dst++;
-			}
-		} while (len > 0);
+					x += chunk;
+					w -= chunk;
+				}
+			} while (len > 0);
+		}
 
 		stream->seek(pos + lineSize, SEEK_SET);
 	}
 }
 
-bool SMUSHVideo::handleBlocky16(GraphicsManager &gfx, uint32 size) {
+bool SMUSHVideo::handleBlocky16(VideoSink &sink, uint32 size) {
 	if (!isHighColor()) {
 		fprintf(stderr, "Blocky16 chunk in 8bpp video\n");
 		return false;
@@ -1036,19 +1301,81 @@ bool SMUSHVideo::handleBlocky16(GraphicsManager &gfx, uint32 size) {
 	if (!_blocky16)
 		_blocky16 = new Blocky16(_width, _height);
 
-	if (!_buffer) {
-		_buffer = new byte[_pitch * _height];
-		memset(_buffer, 0, _pitch * _height);
-	}
-
-	_blocky16->decode(_buffer, ptr);
+	// Nothing else draws into SANM frames, so blit straight from the
+	// decoder's buffer
+	const byte *frame = _blocky16->decode(ptr);
 
 	delete[] ptr;
 
-	gfx.blit(_buffer, 0, 0, _width, _height, _pitch);
+	if (frame) {
+		const byte *dirtyBlocks = _blocky16->getDirtyBlocks();
+
+		if (dirtyBlocks)
+			blitDirtyBlocks(sink, frame, dirtyBlocks, 8);
+		else
+			sink.blit(frame, 0, 0, _width, _height, _pitch);
+	}
+
 	return true;
 }
 
+void SMUSHVideo::blitRect(VideoSink &sink, const byte *frame, const Rect &rect) {
+	if (rect.isEmpty())
+		return;
+
+	uint bytesPerPixel = isHighColor() ? 2 : 1;
+	sink.blit(frame + rect.top * _pitch + rect.left * bytesPerPixel, rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top, _pitch);
+}
+
+void SMUSHVideo::blitDirtyBlocks(VideoSink &sink, const byte *frame, const byte *dirtyBlocks, int blockSize) {
+	int blockWidth = (_width + blockSize - 1) / blockSize;
+	int blockHeight = (_height + blockSize - 1) / blockSize;
+
+	// Runs of dirty blocks on a row become one rectangle, which keeps
+	// growing down for as long as the rows below have a run with the same
+	// span. open holds the rectangles that touch the previous row, from
+	// left to right.
+	std::vector<Rect> rects;
+	std::vector<uint> open, nextOpen;
+
+	for (int y = 0; y < blockHeight; y++) {
+		const byte *dirty = dirtyBlocks + y * blockWidth;
+		uint nextMatch = 0;
+		nextOpen.clear();
+
+		for (int x = 0; x < blockWidth; x++) {
+			if (!dirty[x])
+				continue;
+
+			int end = x + 1;
+			while (end < blockWidth && dirty[end])
+				end++;
+
+			Rect run(x * blockSize, y * blockSize, end * blockSize, (y + 1) * blockSize);
+
+			while (nextMatch < open.size() && rects[open[nextMatch]].left < run.left)
+				nextMatch++;
+
+			if (nextMatch < open.size() && rects[open[nextMatch]].left == run.left && rects[open[nextMatch]].right == run.right) {
+				rects[open[nextMatch]].bottom = run.bottom;
+				nextOpen.push_back(open[nextMatch]);
+			} else {
+				nextOpen.push_back(rects.size());
+				rects.push_back(run);
+			}
+
+			x = end;
+		}
+
+		open.swap(nextOpen);
+	}
+
+	for (uint i = 0; i < rects.size(); i++) {
+		rects[i].clip(_width, _height);
+		blitRect(sink, frame, rects[i]);
+	}
+}
+
 bool SMUSHVideo::detectFrameSize() {
 	// There is no frame size, so we'll be using a heuristic to detect it.
 
@@ -1160,11 +1487,6 @@ bool SMUSHVideo::detectFrameSize() {
 
 bool SMUSHVideo::handleVIMA(uint32 size) {
 	// VIMA Audio (SANM-only)
-	if (!_vimaDestTable) {
-		_vimaDestTable = new uint16[5786];
-		initVIMA(_vimaDestTable);
-	}
-
 	int flags = FLAG_16BITS;
 #if SDL_BYTEORDER == SDL_LIL_ENDIAN
 	flags |= FLAG_LITTLE_ENDIAN;
@@ -1187,7 +1509,7 @@ bool SMUSHVideo::handleVIMA(uint32 size) {
 	_file->read(src, size);
 
 	int16 *dst = new int16[decompressedSize * _audioChannels];
-	decompressVIMA(src, dst, decompressedSize * _audioChannels * 2, _vimaDestTable);
+	decompressVIMA(src, dst, decompressedSize * _audioChannels * 2);
 
 	delete[] src;
 
@@ -1261,94 +1583,93 @@ bool operator<(const SMUSHTrackHandle &handle1, const SMUSHTrackHandle &handle2)
 	return false;
 }
 
-void SMUSHVideo::decodeCodec31(SeekableReadStream *stream, int left, int top, uint width, uint height) {
-	// SegaCD-modified codec1 - uses high and low nibbles of the value to output
-	// Maps to palette #1, with transparency
-
-	for (uint y = 0; y < height; y++) {
-		uint16 lineSize = stream->readUint16LE();
-		byte *dst = _buffer + (top + y) * _pitch + left;
+// The Sega CD codecs pack two pixels into each byte, one per nibble. These
+// tables hold the resulting pixel pairs for every byte value: codec 31 maps
+// to palette #1 (224-239) with 0 staying transparent, and codec 32 maps to
+// palette #2 (240-255).
+static byte nibblePairs[2][256][2];
+static bool nibblePairsReady = false;
 
-		while (lineSize > 0) {
-			byte code = stream->readByte();
-			lineSize--;
-			byte length = (code >> 1) + 1;
-
-			if (code & 1) {
-				byte val = stream->readByte();
-				lineSize--;
-
-				byte pixel1 = val & 0xF;
-				byte pixel2 = val >> 4;
-
-				for (int i = 0; i < length; i++) {
-					if (pixel1 != 0)
-						dst[0] = pixel1 + 224;
-
-					if (pixel2 != 0)
-						dst[1] = pixel2 + 224;
-
-					dst += 2;
-				}
-			} else {
-				lineSize -= length;
+static void initNibblePairs() {
+	if (nibblePairsReady)
+		return;
 
-				while (length--) {
-					byte val = stream->readByte();
-					byte pixel1 = val & 0xF;
-					byte pixel2 = val >> 4;
+	for (int i = 0; i < 256; i++) {
+		byte pixel1 = i & 0xF;
+		byte pixel2 = i >> 4;
 
-					if (pixel1 != 0)
-						dst[0] = pixel1 + 224;
+		nibblePairs[0][i][0] = (pixel1 != 0) ? pixel1 + 224 : 0;
+		nibblePairs[0][i][1] = (pixel2 != 0) ? pixel2 + 224 : 0;
+		nibblePairs[1][i][0] = pixel1 + 224 + 16;
+		nibblePairs[1][i][1] = pixel2 + 224 + 16;
+	}
 
-					if (pixel2 != 0)
-						dst[1] = pixel2 + 224;
+	nibblePairsReady = true;
+}
 
-					dst += 2;
-				}
-			}
-		}
-	}
+void SMUSHVideo::decodeCodec31(SeekableReadStream *stream, int left, int top, uint width, uint height) {
+	// SegaCD-modified codec1 - uses high and low nibbles of the value to output
+	// Maps to palette #1, with transparency
+	decodeSegaCDCodec(stream, left, top, width, height, true);
 }
 
 void SMUSHVideo::decodeCodec32(SeekableReadStream *stream, int left, int top, uint width, uint height) {
 	// SegaCD-modified codec1 - uses high and low nibbles of the value to output
 	// Maps to palette #2, no transparency
+	decodeSegaCDCodec(stream, left, top, width, height, false);
+}
+
+void SMUSHVideo::decodeSegaCDCodec(SeekableReadStream *stream, int left, int top, uint width, uint height, bool transparent) {
+	initNibblePairs();
+	const byte (*pairs)[2] = nibblePairs[transparent ? 0 : 1];
+
+	Rect clip(left, top, left + width, top + height);
+	clip.clip(_width, _height);
 
 	for (uint y = 0; y < height; y++) {
 		uint16 lineSize = stream->readUint16LE();
-		byte *dst = _buffer + (top + y) * _pitch + left;
+		int realY = top + y;
+
+		if (realY < clip.top || realY >= clip.bottom) {
+			stream->seek(lineSize, SEEK_CUR);
+			continue;
+		}
+
+		byte *row = _buffer + realY * _pitch;
+		byte *layerRow = _layer ? _layer + realY * _pitch : 0;
+		int x = left;
 
 		while (lineSize > 0) {
 			byte code = stream->readByte();
 			lineSize--;
 			byte length = (code >> 1) + 1;
 
+			// Expand the run into pixel pairs first, then put it on the
+			// frame in one go
+			byte pixels[256];
+
 			if (code & 1) {
 				byte val = stream->readByte();
 				lineSize--;
 
-				byte pixel1 = val & 0xF;
-				byte pixel2 = val >> 4;
-
-				for (int i = 0; i < length; i++) {
-					dst[0] = pixel1 + 224 + 16;
-					dst[1] = pixel2 + 224 + 16;
-					dst += 2;
-				}
+				for (int i = 0; i < length; i++)
+					memcpy(pixels + i * 2, pairs[val], 2);
 			} else {
 				lineSize -= length;
 
-				while (length--) {
-					byte val = stream->readByte();
-					byte pixel1 = val & 0xF;
-					byte pixel2 = val >> 4;
+				byte packed[128];
+				stream->read(packed, length);
 
-					dst[0] = pixel1 + 224 + 16;
-					dst[1] = pixel2 + 224 + 16;
-					dst += 2;
-				}
+				for (int i = 0; i < length; i++)
+					memcpy(pixels + i * 2, pairs[packed[i]], 2);
 			}
+
+			drawRun(row, x, pixels, length * 2, clip, transparent);
+
+			if (layerRow)
+				drawRun(layerRow, x, pixels, length * 2, clip, transparent);
+
+			x += length * 2;
 		}
 	}
 }
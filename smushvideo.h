@@ -27,17 +27,19 @@
 #define SMUSHVIDEO_H
 
 #include <map>
-#include "graphicsman.h"
 #include "types.h"
+#include "util.h"
 
 class AudioManager;
 class Blocky16;
 class Codec37Decoder;
 class Codec47Decoder;
 class Codec48Decoder;
+class GraphicsManager;
 class SeekableReadStream;
 class SMUSHChannel;
 class QueuingAudioStream;
+class VideoSink;
 
 struct SMUSHTrackHandle {
 	uint32 type;
@@ -49,17 +51,33 @@ bool operator<(const SMUSHTrackHandle &handle1, const SMUSHTrackHandle &handle2)
 
 class SMUSHVideo {
 public:
-	SMUSHVideo(AudioManager &audio);
+	/**
+	 * Create a video that plays its sound through audio. Without one (0),
+	 * the sound chunks are skipped, for decoding when nobody listens.
+	 */
+	SMUSHVideo(AudioManager *audio);
 	~SMUSHVideo();
 
 	bool load(const char *fileName);
 	void close();
 	bool isLoaded() const { return _file != 0; }
+
+	/**
+	 * Play the video on the screen in real time, until it ends or the
+	 * window gets closed.
+	 */
 	void play(GraphicsManager &gfx);
 
+	/**
+	 * Decode every frame of the video into sink as fast as possible.
+	 * @return true if every frame was decoded
+	 */
+	bool decode(VideoSink &sink);
+
 	bool isHighColor() const;
 	uint getWidth() const;
 	uint getHeight() const;
+	void getFrameRate(uint &numerator, uint &denominator) const;
 
 private:
 	SeekableReadStream *_file;
@@ -70,8 +88,13 @@ private:
 	uint _version, _frameCount;
 
 	// Palette
+	// The screen only holds converted pixels, so the whole frame has to be
+	// blitted again once the palette changes.
 	byte _palette[256 * 3];
-	uint16 _deltaPalette[256 * 3];
+	int16 _deltaPalette[256 * 3];
+	bool _redrawFrame;
+	void setPalette(VideoSink &sink);
+	void readDeltaPalette();
 
 	// Main Buffer
 	byte *_buffer;
@@ -82,31 +105,55 @@ private:
 	bool _storeFrame;
 	byte *_storedFrame;
 
+	// Frame Object Layer
+	// The transparent frame objects are drawn straight onto _buffer, and
+	// _layerRect covers what they drew in the current frame. Once a video
+	// has used GOST, they're also drawn onto _layer (with 0 as the
+	// transparent color), and only that area gets cleared for the next one.
+	byte *_layer;
+	Rect _layerRect;
+	void clearLayer();
+
+	// Screen Updates
+	// Only the parts of _buffer that changed get blitted. Codecs 37, 47,
+	// and 48 report which blocks differ from their own last frame, so
+	// whatever got drawn over that frame since is kept in _staleRect.
+	byte _lastFrameCodec;
+	Rect _staleRect;
+	void blitRect(VideoSink &sink, const byte *frame, const Rect &rect);
+	void blitDirtyBlocks(VideoSink &sink, const byte *frame, const byte *dirtyBlocks, int blockSize);
+
 	// Main Functions
+	// play() shows the frames that decodeFrames() puts together on its own
+	// thread
+	GraphicsManager *_gfx;
+	static int decodeThread(void *data);
+	bool decodeFrames(VideoSink &sink, bool realTime);
 	bool readHeader();
-	bool handleFrame(GraphicsManager &gfx);
+	bool handleFrame(VideoSink &sink);
 	bool readFrameHeader();
 	uint32 getNextFrameTime(uint32 curFrame) const;
 
 	// Frame Types
-	bool handleBlocky16(GraphicsManager &gfx, uint32 size);
-	bool handleFrameObject(GraphicsManager &gfx, uint32 size);
-	bool handleFetch(uint32 size);
-	bool handleGhost(uint32 size);
+	bool handleBlocky16(VideoSink &sink, uint32 size);
+	bool handleFrameObject(VideoSink &sink, uint32 size);
+	bool handleFetch(VideoSink &sink, uint32 size);
+	bool handleGhost(VideoSink &sink, uint32 size);
 	bool handleIACT(uint32 size);
-	bool handleNewPalette(GraphicsManager &gfx, uint32 size);
+	bool handleNewPalette(VideoSink &sink, uint32 size);
 	bool handleStore(uint32 size);
-	bool handleDeltaPalette(GraphicsManager &gfx, uint32 size);
+	bool handleDeltaPalette(VideoSink &sink, uint32 size);
 	bool handleSoundFrame(uint32 type, uint32 size);
 	bool handleVIMA(uint32 size);
-	bool handleZlibFrameObject(GraphicsManager &gfx, uint32 size);
+	bool handleZlibFrameObject(VideoSink &sink, uint32 size);
 
 	// Codecs
-	bool handleFrameObject(GraphicsManager &gfx, SeekableReadStream *stream, uint32 size);
+	bool handleFrameObject(VideoSink &sink, SeekableReadStream *stream, uint32 size);
 	void decodeCodec1(SeekableReadStream *stream, int left, int top, uint width, uint height);
 	void decodeCodec21(SeekableReadStream *stream, int left, int top, uint width, uint height);
 	void decodeCodec31(SeekableReadStream *stream, int left, int top, uint width, uint height);
 	void decodeCodec32(SeekableReadStream *stream, int left, int top, uint width, uint height);
+	void decodeSegaCDCodec(SeekableReadStream *stream, int left, int top, uint width, uint height, bool transparent);
 	Codec37Decoder *_codec37;
 	Codec47Decoder *_codec47;
 	Codec48Decoder *_codec48;
@@ -127,7 +174,6 @@ private:
 	QueuingAudioStream *_iactStream;
 	byte *_iactBuffer;
 	uint32 _iactPos;
-	uint16 *_vimaDestTable;
 	SMUSHChannel *findAudioTrack(const SMUSHTrackHandle &track);
 	typedef std::map<SMUSHTrackHandle, SMUSHChannel *> ChannelMap;
 	ChannelMap _audioTracks;
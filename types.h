@@ -33,5 +33,6 @@ typedef Sint16 int16;
 typedef Uint16 uint16;
 typedef Sint32 int32;
 typedef Uint32 uint32;
+typedef Uint64 uint64;
 
 #endif
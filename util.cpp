@@ -60,3 +60,43 @@ uint32 READ_BE_UINT32(const void *ptr) {
 	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
 #endif
 }
+
+byte *allocateGuardedBuffers(byte **buffers, int count, int32 size, int32 guardSize, int32 &allocSize) {
+	// Rounding both sizes up keeps every buffer on the same alignment as the
+	// first one
+	guardSize = (guardSize + 15) & ~15;
+	int32 stride = ((size + 15) & ~15) + guardSize;
+
+	// new[] doesn't promise more than the alignment of the largest basic
+	// type, so leave room to align the first buffer by hand
+	allocSize = guardSize + stride * count + 15;
+	byte *alloc = new byte[allocSize]();
+	byte *base = alloc + ((16 - ((size_t)alloc & 15)) & 15);
+
+	for (int i = 0; i < count; i++)
+		buffers[i] = base + guardSize + stride * i;
+
+	return alloc;
+}
+
+void Rect::clip(int width, int height) {
+	left = MAX(left, 0);
+	top = MAX(top, 0);
+	right = MIN(right, width);
+	bottom = MIN(bottom, height);
+}
+
+void Rect::extend(const Rect &r) {
+	if (r.isEmpty())
+		return;
+
+	if (isEmpty()) {
+		*this = r;
+		return;
+	}
+
+	left = MIN(left, r.left);
+	top = MIN(top, r.top);
+	right = MAX(right, r.right);
+	bottom = MAX(bottom, r.bottom);
+}
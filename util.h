@@ -38,6 +38,37 @@ uint32 READ_LE_UINT32(const void *ptr);
 uint16 READ_BE_UINT16(const void *ptr);
 uint32 READ_BE_UINT32(const void *ptr);
 
+/**
+ * Allocate count frame buffers of size bytes, as used by the block codecs,
+ * with a guard band of at least guardSize bytes before and after each of
+ * them. Block copies that reach up to guardSize bytes outside of a buffer
+ * stay inside the allocation. Every buffer starts on a 16 byte boundary
+ * and all of the memory is zeroed.
+ *
+ * @param buffers receives the start of each buffer
+ * @param allocSize receives the size of the whole allocation
+ * @return the allocation, to be freed with delete[]
+ */
+byte *allocateGuardedBuffers(byte **buffers, int count, int32 size, int32 guardSize, int32 &allocSize);
+
+/**
+ * A rectangle of pixels. right and bottom are exclusive.
+ */
+struct Rect {
+	Rect() : left(0), top(0), right(0), bottom(0) {}
+	Rect(int l, int t, int r, int b) : left(l), top(t), right(r), bottom(b) {}
+
+	bool isEmpty() const { return left >= right || top >= bottom; }
+
+	/** Clip this rectangle against a width x height screen */
+	void clip(int width, int height);
+
+	/** Grow this rectangle to also cover r */
+	void extend(const Rect &r);
+
+	int left, top, right, bottom;
+};
+
 inline uint16 SWAP_BYTES_16(const uint16 a) {
 	return (a >> 8) | (a << 8);
 }
@@ -0,0 +1,78 @@
+/* smushplay - A simple LucasArts SMUSH video player
+ *
+ * smushplay is the legal property of its developers, whose names can be
+ * found in the AUTHORS file distributed with this source
+ * distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef VIDEOSINK_H
+#define VIDEOSINK_H
+
+#include "types.h"
+
+/**
+ * Where decoded frames go. Each frame is put together with blit() and
+ * setPalette(), then finished with update(). Pixels are 8bpp palette
+ * indices, or native endian RGB565 for high color videos.
+ */
+class VideoSink {
+public:
+	virtual ~VideoSink() {}
+
+	/**
+	 * Copy part of a frame into the frame that is being put together.
+	 */
+	virtual void blit(const byte *ptr, uint x, uint y, uint width, uint height, uint pitch) = 0;
+
+	/**
+	 * Change colors of the palette of 8bpp videos.
+	 *
+	 * @return true if the whole frame has to be blitted again for the new
+	 * colors to show
+	 */
+	virtual bool setPalette(const byte *ptr, uint start, uint count) = 0;
+
+	/**
+	 * Finish the frame that was put together since the last update.
+	 *
+	 * @param time when the frame is due, in milliseconds from the start
+	 */
+	virtual void update(uint32 time) = 0;
+
+	/**
+	 * Signal that there are no more frames coming.
+	 */
+	virtual void finish() {}
+
+	/**
+	 * @return true if the sink doesn't want any more frames
+	 */
+	virtual bool isStopped() { return false; }
+};
+
+/**
+ * A sink that throws away every frame, for decoding without a screen.
+ */
+class NullVideoSink : public VideoSink {
+public:
+	void blit(const byte *, uint, uint, uint, uint, uint) {}
+	bool setPalette(const byte *, uint, uint) { return false; }
+	void update(uint32) {}
+};
+
+#endif
@@ -100,7 +100,13 @@ static const int8 *const offsets[] = {
 	imcOtherTable4, imcOtherTable5, imcOtherTable6
 };
 
-void initVIMA(uint16 *destTable) {
+// Only the first 89 * 64 entries are used
+static uint16 vimaDestTable[89 * 64];
+static bool vimaDestTableReady = false;
+
+static void initVIMA() {
+	uint16 *destTable = vimaDestTable;
+
 	for (int destTableStartPos = 0, incer = 0; destTableStartPos < 64; destTableStartPos++, incer++) {
 		for (uint32 imcTable1Pos = 0, destTablePos = destTableStartPos; imcTable1Pos < sizeof(imcTable1) / sizeof(imcTable1[0]); imcTable1Pos++, destTablePos += 64) {
 			int put = 0;
@@ -112,9 +118,16 @@ void initVIMA(uint16 *destTable) {
 			destTable[destTablePos] = put;
 		}
 	}
+
+	vimaDestTableReady = true;
 }
 
-void decompressVIMA(const byte *src, int16 *dest, int destLen, uint16 *destTable) {
+void decompressVIMA(const byte *src, int16 *dest, int destLen) {
+	// The table is the same for every stream, so build it once
+	if (!vimaDestTableReady)
+		initVIMA();
+
+	const uint16 *destTable = vimaDestTable;
 	int numChannels = 1;
 	byte sBytes[2];
 
@@ -27,7 +27,6 @@
 
 #include "types.h"
 
-void initVIMA(uint16 *destTable);
-void decompressVIMA(const byte *src, int16 *dest, int destLen, uint16 *destTable);
+void decompressVIMA(const byte *src, int16 *dest, int destLen);
 
 #endif